@@ -7,16 +7,15 @@
 #include "engine/common/color_utils.hpp"
 
 #include "physics/physics.hpp"
+#include "physics/scenario.hpp"
 #include "thread_pool/thread_pool.hpp"
 #include "renderer/renderer.hpp"
 #include "engine/common/time_analyzer.hpp"
+#include "engine/common/profiler.hpp"
 
 
 int main()
 {
-    srand((unsigned)time(NULL));
-
-
     const uint32_t window_width = 1920;
     const uint32_t window_height = 1080;
     WindowContextHandler app("Vicsek Model - MultiThread", sf::Vector2u(window_width, window_height), sf::Style::Default);
@@ -50,69 +49,15 @@ int main()
         });
 
  
-    for (uint32_t i{ 40000 }; i--;) {
-        double random_x = ((double)rand() / RAND_MAX) * world_size.x;
-        double random_y = ((double)rand() / RAND_MAX) * world_size.y;
-
-
-        const auto id = solver.createObject({ random_x, random_y}, 'S');
-
-        solver.objects[id].velocity.x = ((double)rand() / RAND_MAX) * 10 - 5;
-        solver.objects[id].velocity.y = ((double)rand() / RAND_MAX) * 10 - 5;
-    }
-
-    
-    for (uint32_t i{ 130 }; i--;) {
-        for (uint32_t j{ 2 }; j--;) {
-            const auto id = solver.createObject({ 20.0 + i*2, 100.0 + j*2 }, 'O');
-            solver.objects[id].velocity.x = 1.0;
-        }
-    }
-    
-    for (uint32_t i{ 2 }; i--;) {
-        for (uint32_t j{ 100 }; j--;) {
-            const auto id = solver.createObject({ 20.0 + i * 2, 100.0 + j * 2 }, 'O');
-            solver.objects[id].velocity.x = 1.0;
-        }
-    }
-    
-    for (uint32_t i{ 2 }; i--;) {
-        for (uint32_t j{ 110 }; j--;) {
-            const auto id = solver.createObject({ 260.0 + i * 2, 30.0 + j * 2 }, 'O');
-            solver.objects[id].velocity.x = 1.0;
-        }
-    }
-
-    for (uint32_t i{ 100 }; i--;) {
-        for (uint32_t j{ 2 }; j--;) {
-            const auto id = solver.createObject({ 20.0 + i * 2, 200.0 + j * 2 }, 'O');
-            solver.objects[id].velocity.x = 1.0;
-        }
-    }
-
+    solver.seed = static_cast<uint64_t>(time(NULL));
+    Scenario::loadDefault(solver, 40000);
 
-    for (uint32_t i{ 60 }; i--;) {
-        for (uint32_t j{ 2 }; j--;) {
-            const auto id = solver.createObject({ 140.0 + i * 2, 240.0 + j * 2 }, 'O');
-            solver.objects[id].velocity.x = 1.0;
-        }
-    }
-    /*
-    for (uint32_t i{ 100 }; i--;) {
-        for (uint32_t j{ 2 }; j--;) {
-            const auto id = solver.createObject({ 20.0 + i * 2, 280.0 + j * 2 }, 'O');
-            solver.objects[id].velocity.x = 1.0;
-        }
-    }
-    */
     const float dt = 1.0f / static_cast<float>(fps_cap);
 
-    clock_t time_req;
-
     // Main loop
 
     while (app.run()) {
-        time_req = clock();
+        ProfileScope frame_scope{ "frame" };
 
         if (!pasuse) {
 
@@ -121,7 +66,7 @@ int main()
         render_context.clear();
         renderer.render(render_context);
         render_context.display();
-        TimeAnalyzer::getInstance().setFPS(1000 / (clock() - time_req));
+        TimeAnalyzer::getInstance().setFPS(to<uint16_t>(1000.0 / std::max(frame_scope.getElapsedMs(), 1.0)));
     }
 
     return 0;
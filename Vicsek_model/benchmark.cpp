@@ -0,0 +1,312 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#include "../lib_addons/json.hpp"
+
+#include "physics/physics.hpp"
+#include "physics/scenario.hpp"
+#include "thread_pool/thread_pool.hpp"
+
+
+// Sweeps agent counts, world sizes, view ranges and thread counts and times each step phase
+struct BenchmarkConfig
+{
+    std::vector<uint32_t> agents      = { 10000, 100000, 1000000 };
+    std::vector<uint32_t> worlds      = { 300, 1000 };
+    std::vector<uint32_t> view_range  = { 5 };
+    std::vector<uint32_t> threads     = { 1, std::max(1u, std::thread::hardware_concurrency()) };
+    uint32_t              warmup      = 5;
+    uint32_t              steps       = 20;
+    uint32_t              seed        = 1;
+    uint32_t              reorder     = 0;
+    uint32_t              field       = 0;
+    uint32_t              grain       = tp::ThreadPool::default_grain_size;
+    uint32_t              spin        = tp::ThreadPool::default_spin_count;
+    bool                  pin         = false;
+    bool                  symmetric   = false;
+    bool                  incremental = false;
+    bool                  pipeline    = false;
+    std::string           csv_path    = "benchmark.csv";
+    std::string           json_path   = "benchmark.json";
+};
+
+struct PhaseStats
+{
+    std::vector<double> samples;
+
+    [[nodiscard]]
+    double getMean() const
+    {
+        double sum = 0.0;
+        for (const double v : samples) {
+            sum += v;
+        }
+        return samples.empty() ? 0.0 : sum / static_cast<double>(samples.size());
+    }
+
+    [[nodiscard]]
+    double getMin() const
+    {
+        return samples.empty() ? 0.0 : *std::min_element(samples.begin(), samples.end());
+    }
+
+    [[nodiscard]]
+    double getMedian() const
+    {
+        if (samples.empty()) {
+            return 0.0;
+        }
+        std::vector<double> sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+        return sorted[sorted.size() / 2];
+    }
+};
+
+struct BenchmarkResult
+{
+    uint32_t   agents;
+    uint32_t   world;
+    uint32_t   view_range;
+    uint32_t   threads;
+    uint64_t   objects;
+    PhaseStats grid;
+    PhaseStats neighbours;
+    PhaseStats integration;
+    PhaseStats total;
+    // Worker idle time over the timed steps
+    tp::IdleStats idle;
+};
+
+static void printUsage()
+{
+    std::cout << "Usage: vicsek_benchmark [options]\n"
+              << "  --agents L      comma separated agent counts (10000,100000,1000000)\n"
+              << "  --worlds L      comma separated world sizes (300,1000)\n"
+              << "  --views L       comma separated view ranges (5)\n"
+              << "  --threads L     comma separated thread counts (1,hardware concurrency)\n"
+              << "  --warmup N      untimed steps before measuring (5)\n"
+              << "  --steps N       timed steps per configuration (20)\n"
+              << "  --seed N        random seed of the scenario (1)\n"
+              << "  --reorder N     sort objects by cell every N steps, 0 disables it (0)\n"
+              << "  --field N       obstacle field samples per unit, 0 evaluates every obstacle (0)\n"
+              << "  --grain N       elements per parallel loop chunk (1024)\n"
+              << "  --spin N        failed work searches before a worker parks (64)\n"
+              << "  --pin 1         pin the workers on the CPUs, spread over the NUMA nodes (0)\n"
+              << "  --symmetric 1   half stencil neighbour search, each pair evaluated once (0)\n"
+              << "  --incremental 1 only move the objects that changed cell in the grid (0)\n"
+              << "  --pipeline 1    neighbour search and integration as one task graph, timed as neighbours, needs --reorder (0)\n"
+              << "  --csv PATH      CSV output (benchmark.csv)\n"
+              << "  --json PATH     JSON output (benchmark.json)\n";
+}
+
+static std::vector<uint32_t> parseList(const std::string& list)
+{
+    std::vector<uint32_t> values;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        const uint32_t value = static_cast<uint32_t>(std::strtoul(item.c_str(), nullptr, 10));
+        if (value) {
+            values.push_back(value);
+        }
+    }
+    return values;
+}
+
+static bool parseArguments(int argc, char** argv, BenchmarkConfig& config)
+{
+    for (int i{ 1 }; i + 1 < argc; i += 2) {
+        const std::string arg   = argv[i];
+        const std::string value = argv[i + 1];
+        if (arg == "--agents") {
+            config.agents = parseList(value);
+        } else if (arg == "--worlds") {
+            config.worlds = parseList(value);
+        } else if (arg == "--views") {
+            config.view_range = parseList(value);
+        } else if (arg == "--threads") {
+            config.threads = parseList(value);
+        } else if (arg == "--warmup") {
+            config.warmup = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        } else if (arg == "--steps") {
+            config.steps = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        } else if (arg == "--seed") {
+            config.seed = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        } else if (arg == "--reorder") {
+            config.reorder = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        } else if (arg == "--field") {
+            config.field = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        } else if (arg == "--grain") {
+            config.grain = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        } else if (arg == "--spin") {
+            config.spin = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        } else if (arg == "--pin") {
+            config.pin = value != "0";
+        } else if (arg == "--symmetric") {
+            config.symmetric = value != "0";
+        } else if (arg == "--incremental") {
+            config.incremental = value != "0";
+        } else if (arg == "--pipeline") {
+            config.pipeline = value != "0";
+        } else if (arg == "--csv") {
+            config.csv_path = value;
+        } else if (arg == "--json") {
+            config.json_path = value;
+        } else {
+            return false;
+        }
+    }
+    // The pipelined update only pays off on objects sorted by cell, see PhysicSolver::pipelined_update
+    return argc % 2 == 1 && !config.agents.empty() && !config.worlds.empty() &&
+           !config.view_range.empty() && !config.threads.empty() && config.steps && config.grain &&
+           (!config.pipeline || config.reorder);
+}
+
+static double getElapsedMs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static BenchmarkResult run(const BenchmarkConfig& config, uint32_t agents, uint32_t world, uint32_t view_range, uint32_t threads)
+{
+    tp::ThreadPool thread_pool(threads);
+    thread_pool.m_grain_size = config.grain;
+    thread_pool.m_spin_count = config.spin;
+    if (config.pin) {
+        thread_pool.pin(tp::CpuTopology::discover());
+    }
+    const IVec2 world_size{ static_cast<int32_t>(world), static_cast<int32_t>(world) };
+    PhysicSolver solver{ world_size, view_range, thread_pool };
+    solver.seed = config.seed;
+    solver.reorder_period = config.reorder;
+    solver.symmetric_contacts = config.symmetric;
+    solver.incremental_grid = config.incremental;
+    solver.pipelined_update = config.pipeline;
+    solver.obstacle_field_resolution = config.field;
+    Scenario::loadDefault(solver, agents);
+
+    BenchmarkResult result{};
+    result.agents     = agents;
+    result.world      = world;
+    result.view_range = view_range;
+    result.threads    = threads;
+    result.objects    = solver.objects.size();
+    const float dt = 1.0f / 60.0f;
+    tp::IdleStats idle_start;
+    for (uint32_t step{ 0 }; step < config.warmup + config.steps; ++step) {
+        if (step == config.warmup) {
+            idle_start = thread_pool.getIdleStats();
+        }
+        auto start = std::chrono::steady_clock::now();
+        solver.addObjectsToGrid();
+        const double grid_ms = getElapsedMs(start);
+
+        // Pipelined steps have no separate integration, it is counted with the neighbours
+        start = std::chrono::steady_clock::now();
+        if (config.pipeline) {
+            solver.solveAndIntegrate(dt);
+        }
+        else {
+            solver.solveNeighborhood();
+        }
+        const double neighbours_ms = getElapsedMs(start);
+
+        start = std::chrono::steady_clock::now();
+        if (!config.pipeline) {
+            solver.updateObjects_multi(dt);
+        }
+        const double integration_ms = getElapsedMs(start);
+
+        if (step >= config.warmup) {
+            result.grid.samples.push_back(grid_ms);
+            result.neighbours.samples.push_back(neighbours_ms);
+            result.integration.samples.push_back(integration_ms);
+            result.total.samples.push_back(grid_ms + neighbours_ms + integration_ms);
+        }
+    }
+    const tp::IdleStats idle_end = thread_pool.getIdleStats();
+    result.idle = { idle_end.spin_ms - idle_start.spin_ms, idle_end.park_ms - idle_start.park_ms, idle_end.parks - idle_start.parks };
+    return result;
+}
+
+static nlohmann::json toJson(const PhaseStats& stats)
+{
+    return { { "mean_ms", stats.getMean() }, { "median_ms", stats.getMedian() }, { "min_ms", stats.getMin() }, { "samples_ms", stats.samples } };
+}
+
+int main(int argc, char** argv)
+{
+    BenchmarkConfig config;
+    if (!parseArguments(argc, argv, config)) {
+        printUsage();
+        return 1;
+    }
+
+    std::ofstream csv(config.csv_path);
+    if (!csv) {
+        std::cout << "Cannot open " << config.csv_path << std::endl;
+        return 1;
+    }
+    csv << "agents,world,view_range,threads,objects,grid_mean_ms,grid_median_ms,neighbours_mean_ms,neighbours_median_ms,"
+           "integration_mean_ms,integration_median_ms,total_mean_ms,total_median_ms\n";
+
+    nlohmann::json json;
+    json["warmup"]      = config.warmup;
+    json["steps"]       = config.steps;
+    json["seed"]        = config.seed;
+    json["reorder"]     = config.reorder;
+    json["field"]       = config.field;
+    json["grain"]       = config.grain;
+    json["spin"]        = config.spin;
+    json["pin"]         = config.pin;
+    json["symmetric"]   = config.symmetric;
+    json["incremental"] = config.incremental;
+    json["pipeline"]    = config.pipeline;
+    json["runs"]        = nlohmann::json::array();
+
+    for (const uint32_t agents : config.agents) {
+        for (const uint32_t world : config.worlds) {
+            for (const uint32_t view_range : config.view_range) {
+                for (const uint32_t threads : config.threads) {
+                    const BenchmarkResult r = run(config, agents, world, view_range, threads);
+                    std::printf("agents %8u  world %5u  view %3u  threads %3u  |  grid %8.3f  neighbours %8.3f  integration %8.3f  total %8.3f ms\n",
+                                agents, world, view_range, threads,
+                                r.grid.getMedian(), r.neighbours.getMedian(), r.integration.getMedian(), r.total.getMedian());
+                    std::fflush(stdout);
+
+                    csv << r.agents << ',' << r.world << ',' << r.view_range << ',' << r.threads << ',' << r.objects << ','
+                        << r.grid.getMean() << ',' << r.grid.getMedian() << ','
+                        << r.neighbours.getMean() << ',' << r.neighbours.getMedian() << ','
+                        << r.integration.getMean() << ',' << r.integration.getMedian() << ','
+                        << r.total.getMean() << ',' << r.total.getMedian() << '\n';
+
+                    json["runs"].push_back({
+                        { "agents", r.agents },
+                        { "world", r.world },
+                        { "view_range", r.view_range },
+                        { "threads", r.threads },
+                        { "objects", r.objects },
+                        { "grid", toJson(r.grid) },
+                        { "neighbours", toJson(r.neighbours) },
+                        { "integration", toJson(r.integration) },
+                        { "total", toJson(r.total) },
+                        { "idle", { { "spin_ms", r.idle.spin_ms }, { "park_ms", r.idle.park_ms }, { "parks", r.idle.parks } } },
+                    });
+                }
+            }
+        }
+    }
+
+    std::ofstream json_file(config.json_path);
+    json_file << json.dump(2) << std::endl;
+
+    return 0;
+}
@@ -95,6 +95,9 @@ struct Vector : public GenericProvider
     void               erase(ID id);
     template<typename TPredicate>
     void               remove_if(TPredicate&& f);
+    // Moves the object at data index order[i] to index i, IDs still refer to the same objects
+    template<typename TIndex>
+    void               reorder(const std::vector<TIndex>& order);
     void               clear();
     // Data access by ID
     T&                 operator[](ID id);
@@ -343,6 +346,23 @@ void Vector<T>::remove_if(TPredicate&& f)
     }
 }
 
+template<typename T>
+template<typename TIndex>
+void Vector<T>::reorder(const std::vector<TIndex>& order)
+{
+    std::vector<T>            reordered_data(data_size);
+    std::vector<SlotMetadata> reordered_metadata(data_size);
+    for (uint64_t i{0}; i < data_size; ++i) {
+        reordered_data[i]     = std::move(data[order[i]]);
+        reordered_metadata[i] = metadata[order[i]];
+    }
+    for (uint64_t i{0}; i < data_size; ++i) {
+        data[i]     = std::move(reordered_data[i]);
+        metadata[i] = reordered_metadata[i];
+        ids[metadata[i].rid] = i;
+    }
+}
+
 template<typename T>
 ID Vector<T>::getNextID() const {
     return isFull() ? data_size : metadata[data_size].rid;
@@ -1,5 +1,6 @@
 #pragma once
 #include <random>
+#include <cstdint>
 
 
 class NumberGenerator
@@ -155,3 +156,51 @@ using RNGi32 = RNGi<int32_t>;
 using RNGi64 = RNGi<int64_t>;
 using RNGu32 = RNGi<uint32_t>;
 using RNGu64 = RNGi<uint64_t>;
+
+
+// Counter-based generator: the ith value of a stream is a pure function of (key, i),
+// where the key is derived from a seed and a stream id (for instance an agent id).
+// Streams need no shared state nor locking, so draws are reproducible whatever the
+// thread that makes them.
+class CounterRNG
+{
+private:
+	uint64_t key;
+	uint64_t counter;
+
+public:
+	CounterRNG(uint64_t seed, uint64_t stream, uint64_t counter_ = 0)
+		: key(mix(seed ^ mix(stream)))
+		, counter(counter_)
+	{}
+
+	// SplitMix64 finalizer
+	static uint64_t mix(uint64_t x)
+	{
+		x += 0x9E3779B97F4A7C15ull;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+		return x ^ (x >> 31);
+	}
+
+	uint64_t next()
+	{
+		return mix(key + 0x9E3779B97F4A7C15ull * counter++);
+	}
+
+	// Uniform in [0, 1)
+	double get()
+	{
+		return static_cast<double>(next() >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	double getUnder(double max)
+	{
+		return get() * max;
+	}
+
+	double getRange(double min, double max)
+	{
+		return min + get() * (max - min);
+	}
+};
@@ -0,0 +1,259 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <memory>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+
+
+// Wall-clock span, `name` has to be a string literal (only the pointer is stored)
+struct ProfileSpan
+{
+    const char* name     = nullptr;
+    uint64_t    start_ns = 0;
+    uint64_t    end_ns   = 0;
+    uint32_t    tag      = 0;
+};
+
+// Ring buffer written by a single thread, the oldest spans are overwritten when full.
+// Readers must only run while the writers are idle (between two steps for instance).
+struct ProfileLane
+{
+    static constexpr uint64_t capacity = 1 << 15;
+
+    std::unique_ptr<ProfileSpan[]> spans;
+    std::atomic<uint64_t>          head = 0;
+
+    ProfileLane()
+        : spans{ std::make_unique<ProfileSpan[]>(capacity) }
+    {}
+
+    void push(const ProfileSpan& span)
+    {
+        const uint64_t h = head.load(std::memory_order_relaxed);
+        spans[h & (capacity - 1)] = span;
+        head.store(h + 1, std::memory_order_release);
+    }
+
+    template<typename TCallback>
+    void forEach(TCallback&& callback) const
+    {
+        const uint64_t h     = head.load(std::memory_order_acquire);
+        const uint64_t count = std::min(h, capacity);
+        for (uint64_t i{ h - count }; i < h; ++i) {
+            callback(spans[i & (capacity - 1)]);
+        }
+    }
+};
+
+class Profiler {
+
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Threads recording after this many lanes are in use are ignored
+    static constexpr uint32_t max_lanes = 256;
+
+    struct Stats
+    {
+        uint64_t count   = 0;
+        double   mean_ms = 0.0;
+        double   p50_ms  = 0.0;
+        double   p99_ms  = 0.0;
+        double   max_ms  = 0.0;
+    };
+
+    static Profiler& getInstance() {
+        static Profiler instance;
+        return instance;
+    }
+
+    // Spans are only recorded when enabled, timing a scope is always available
+    void setEnabled(bool enable) {
+        enabled.store(enable, std::memory_order_relaxed);
+    }
+
+    bool isEnabled() const {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getNowNs() const {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - origin).count());
+    }
+
+    void record(const char* name, uint64_t start_ns, uint64_t end_ns, uint32_t tag) {
+        if (!isEnabled()) {
+            return;
+        }
+        if (ProfileLane* lane = getLane()) {
+            lane->push({ name, start_ns, end_ns, tag });
+        }
+    }
+
+    // Drops the recorded spans, writers must be idle
+    void clear() {
+        forEachLane([](ProfileLane& lane, uint32_t) {
+            lane.head.store(0, std::memory_order_release);
+        });
+    }
+
+    // Distinct span names, in order of first appearance per lane
+    std::vector<const char*> getNames() {
+        std::vector<const char*> names;
+        forEachLane([&names](ProfileLane& lane, uint32_t) {
+            lane.forEach([&names](const ProfileSpan& span) {
+                const auto it = std::find_if(names.begin(), names.end(), [&span](const char* name) {
+                    return std::strcmp(name, span.name) == 0;
+                });
+                if (it == names.end()) {
+                    names.push_back(span.name);
+                }
+            });
+        });
+        return names;
+    }
+
+    Stats getStats(const char* name) {
+        std::vector<double> durations;
+        forEachLane([name, &durations](ProfileLane& lane, uint32_t) {
+            lane.forEach([name, &durations](const ProfileSpan& span) {
+                if (std::strcmp(name, span.name) == 0) {
+                    durations.push_back(static_cast<double>(span.end_ns - span.start_ns) * 1e-6);
+                }
+            });
+        });
+
+        Stats stats;
+        if (durations.empty()) {
+            return stats;
+        }
+        std::sort(durations.begin(), durations.end());
+        double sum = 0.0;
+        for (const double d : durations) {
+            sum += d;
+        }
+        stats.count   = durations.size();
+        stats.mean_ms = sum / static_cast<double>(durations.size());
+        stats.p50_ms  = getPercentile(durations, 0.50);
+        stats.p99_ms  = getPercentile(durations, 0.99);
+        stats.max_ms  = durations.back();
+        return stats;
+    }
+
+    // Chrome trace-event format, to open with chrome://tracing or Perfetto.
+    // Each lane is shown as a thread, the tag of a span is exported in its args.
+    bool exportChromeTrace(const std::string& path) {
+        std::ofstream file(path);
+        if (!file) {
+            return false;
+        }
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        bool first = true;
+        char buffer[256];
+        forEachLane([&](ProfileLane& lane, uint32_t lane_id) {
+            std::snprintf(buffer, sizeof(buffer), "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+                          first ? "" : ",", lane_id, lane_id);
+            file << buffer;
+            first = false;
+            lane.forEach([&](const ProfileSpan& span) {
+                std::snprintf(buffer, sizeof(buffer), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"tag\":%u}}",
+                              span.name, lane_id, static_cast<double>(span.start_ns) * 1e-3,
+                              static_cast<double>(span.end_ns - span.start_ns) * 1e-3, span.tag);
+                file << buffer;
+            });
+        });
+        file << "\n]}\n";
+        return static_cast<bool>(file);
+    }
+
+private:
+    Profiler()
+        : origin{ Clock::now() }
+    {
+        for (auto& lane : lanes) {
+            lane.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~Profiler() {
+        for (auto& lane : lanes) {
+            delete lane.load(std::memory_order_relaxed);
+        }
+    }
+
+    Profiler(const Profiler&) = delete;
+
+    Profiler& operator=(const Profiler&) = delete;
+
+    // Lane of the calling thread, allocated on its first record
+    ProfileLane* getLane() {
+        thread_local ProfileLane* lane       = nullptr;
+        thread_local bool         registered = false;
+        if (!registered) {
+            registered = true;
+            const uint32_t id = lane_count.fetch_add(1, std::memory_order_relaxed);
+            if (id < max_lanes) {
+                lane = new ProfileLane();
+                lanes[id].store(lane, std::memory_order_release);
+            }
+        }
+        return lane;
+    }
+
+    template<typename TCallback>
+    void forEachLane(TCallback&& callback) {
+        const uint32_t count = std::min(lane_count.load(std::memory_order_acquire), max_lanes);
+        for (uint32_t i{ 0 }; i < count; ++i) {
+            if (ProfileLane* lane = lanes[i].load(std::memory_order_acquire)) {
+                callback(*lane, i);
+            }
+        }
+    }
+
+    // Nearest-rank percentile of sorted values
+    static double getPercentile(const std::vector<double>& sorted, double p) {
+        const auto rank = static_cast<uint64_t>(std::ceil(p * static_cast<double>(sorted.size())));
+        return sorted[std::max<uint64_t>(rank, 1) - 1];
+    }
+
+private:
+    Clock::time_point         origin;
+    std::atomic<bool>         enabled    = false;
+    std::atomic<uint32_t>     lane_count = 0;
+    std::atomic<ProfileLane*> lanes[max_lanes];
+};
+
+// Times its lifetime and records it as a span when the profiler is enabled
+class ProfileScope {
+
+public:
+    explicit
+    ProfileScope(const char* name_, uint32_t tag_ = 0)
+        : name{ name_ }
+        , tag{ tag_ }
+        , start_ns{ Profiler::getInstance().getNowNs() }
+    {}
+
+    ~ProfileScope() {
+        Profiler::getInstance().record(name, start_ns, Profiler::getInstance().getNowNs(), tag);
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+    double getElapsedMs() const {
+        return static_cast<double>(Profiler::getInstance().getNowNs() - start_ns) * 1e-6;
+    }
+
+private:
+    const char* name;
+    uint32_t    tag;
+    uint64_t    start_ns;
+};
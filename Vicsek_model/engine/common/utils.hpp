@@ -30,8 +30,10 @@ static std::string toString(T value)
 }
 
 
+#ifndef VICSEK_HEADLESS
 template<typename T>
 sf::Vector2f toVector2f(sf::Vector2<T> v)
 {
     return {to<float>(v.x), to<float>(v.y)};
 }
+#endif
@@ -1,9 +1,21 @@
 #pragma once
+#include <cstdint>
+
+// Headless builds do not depend on SFML
+#ifdef VICSEK_HEADLESS
+#include "vector2.hpp"
+
+using Vec2  = Vector2<double>;
+using FVec2 = Vector2<float>;
+using DVec2 = Vector2<double>;
+using IVec2 = Vector2<int32_t>;
+#else
 #include <SFML/System/Vector2.hpp>
 
 using Vec2  = sf::Vector2d; // sf::Vector2f;
 using FVec2 = sf::Vector2f;	// tego nie byo
 using DVec2 = sf::Vector2d; // tego nie byo
 using IVec2 = sf::Vector2i;
+#endif
 
 
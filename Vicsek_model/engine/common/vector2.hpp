@@ -0,0 +1,101 @@
+#pragma once
+
+
+// Minimal stand-in for sf::Vector2 used by the headless build, which does not depend on SFML.
+// Only the operations used by the simulation are provided.
+template<typename T>
+struct Vector2
+{
+    T x = static_cast<T>(0);
+    T y = static_cast<T>(0);
+
+    Vector2() = default;
+
+    Vector2(T x_, T y_)
+        : x{ x_ }
+        , y{ y_ }
+    {}
+
+    template<typename U>
+    explicit
+    Vector2(const Vector2<U>& v)
+        : x{ static_cast<T>(v.x) }
+        , y{ static_cast<T>(v.y) }
+    {}
+
+    Vector2& operator+=(const Vector2& v)
+    {
+        x += v.x;
+        y += v.y;
+        return *this;
+    }
+
+    Vector2& operator-=(const Vector2& v)
+    {
+        x -= v.x;
+        y -= v.y;
+        return *this;
+    }
+
+    Vector2& operator*=(T f)
+    {
+        x *= f;
+        y *= f;
+        return *this;
+    }
+
+    Vector2& operator/=(T f)
+    {
+        x /= f;
+        y /= f;
+        return *this;
+    }
+};
+
+template<typename T>
+Vector2<T> operator-(const Vector2<T>& v)
+{
+    return { -v.x, -v.y };
+}
+
+template<typename T>
+Vector2<T> operator+(const Vector2<T>& v1, const Vector2<T>& v2)
+{
+    return { v1.x + v2.x, v1.y + v2.y };
+}
+
+template<typename T>
+Vector2<T> operator-(const Vector2<T>& v1, const Vector2<T>& v2)
+{
+    return { v1.x - v2.x, v1.y - v2.y };
+}
+
+template<typename T>
+Vector2<T> operator*(const Vector2<T>& v, T f)
+{
+    return { v.x * f, v.y * f };
+}
+
+template<typename T>
+Vector2<T> operator*(T f, const Vector2<T>& v)
+{
+    return { v.x * f, v.y * f };
+}
+
+template<typename T>
+Vector2<T> operator/(const Vector2<T>& v, T f)
+{
+    return { v.x / f, v.y / f };
+}
+
+template<typename T>
+bool operator==(const Vector2<T>& v1, const Vector2<T>& v2)
+{
+    return v1.x == v2.x && v1.y == v2.y;
+}
+
+template<typename T>
+bool operator!=(const Vector2<T>& v1, const Vector2<T>& v2)
+{
+    return !(v1 == v2);
+}
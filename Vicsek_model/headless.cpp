@@ -0,0 +1,237 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <chrono>
+#include <thread>
+
+#include "physics/physics.hpp"
+#include "physics/scenario.hpp"
+#include "thread_pool/thread_pool.hpp"
+#include "engine/common/profiler.hpp"
+
+
+// Runs the simulation without window nor renderer and prints the duration of each step phase
+struct HeadlessConfig
+{
+    uint32_t steps       = 100;
+    uint32_t agents      = 40000;
+    uint32_t threads     = 0;
+    int32_t  world       = 300;
+    uint32_t view_range  = 5;
+    uint32_t seed        = 1;
+    uint32_t reorder     = 0;
+    uint32_t field       = 0;
+    uint32_t grain       = tp::ThreadPool::default_grain_size;
+    uint32_t spin        = tp::ThreadPool::default_spin_count;
+    bool     pin         = false;
+    bool     quiet       = false;
+    bool     symmetric   = false;
+    bool     incremental = false;
+    bool     pipeline    = false;
+    // Chrome trace output, also enables the phase statistics
+    std::string trace_path;
+};
+
+static void printUsage()
+{
+    std::cout << "Usage: vicsek_headless [options]\n"
+              << "  --steps N       number of simulation steps (100)\n"
+              << "  --agents N      number of agents (40000)\n"
+              << "  --threads N     worker threads (hardware concurrency)\n"
+              << "  --world N       world width and height (300)\n"
+              << "  --view N        view range, also the grid cell size (5)\n"
+              << "  --seed N        random seed of the scenario (1)\n"
+              << "  --reorder N     sort objects by cell every N steps, 0 disables it (0)\n"
+              << "  --field N       bake the obstacles into a field of N samples per unit, 0 disables it (0)\n"
+              << "  --grain N       elements per parallel loop chunk (1024)\n"
+              << "  --spin N        failed work searches before a worker parks (64)\n"
+              << "  --pin           pin the workers on the CPUs, spread over the NUMA nodes\n"
+              << "  --quiet         only print the summary\n"
+              << "  --symmetric     half stencil neighbour search, each pair evaluated once\n"
+              << "  --incremental   only move the objects that changed cell in the grid\n"
+              << "  --pipeline      neighbour search and integration as one task graph, without barrier, needs --reorder\n"
+              << "  --trace PATH    record per thread spans, print p50/p99 per phase and write a Chrome trace\n";
+}
+
+static bool parseArguments(int argc, char** argv, HeadlessConfig& config)
+{
+    for (int i{ 1 }; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--quiet") {
+            config.quiet = true;
+            continue;
+        }
+        if (arg == "--pin") {
+            config.pin = true;
+            continue;
+        }
+        if (arg == "--pipeline") {
+            config.pipeline = true;
+            continue;
+        }
+        if (arg == "--incremental") {
+            config.incremental = true;
+            continue;
+        }
+        if (arg == "--symmetric") {
+            config.symmetric = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return false;
+        }
+        if (arg == "--trace") {
+            config.trace_path = argv[++i];
+            continue;
+        }
+        const uint32_t value = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        if (arg == "--steps") {
+            config.steps = value;
+        } else if (arg == "--agents") {
+            config.agents = value;
+        } else if (arg == "--threads") {
+            config.threads = value;
+        } else if (arg == "--world") {
+            config.world = static_cast<int32_t>(value);
+        } else if (arg == "--view") {
+            config.view_range = value;
+        } else if (arg == "--seed") {
+            config.seed = value;
+        } else if (arg == "--reorder") {
+            config.reorder = value;
+        } else if (arg == "--field") {
+            config.field = value;
+        } else if (arg == "--grain") {
+            config.grain = value;
+        } else if (arg == "--spin") {
+            config.spin = value;
+        } else {
+            return false;
+        }
+    }
+    // The pipelined update only pays off on objects sorted by cell, see PhysicSolver::pipelined_update
+    return config.world > 0 && config.view_range > 0 && config.grain > 0 && (!config.pipeline || config.reorder);
+}
+
+// FNV-1a over positions and velocities in object ID order, to compare runs
+static uint64_t getStateHash(PhysicSolver& solver)
+{
+    uint64_t hash = 14695981039346656037ull;
+    const uint64_t object_count = solver.objects.size();
+    for (uint64_t id{ 0 }; id < object_count; ++id) {
+        const PhysicObject& obj = solver.objects[id];
+        const double values[] = { obj.position.x, obj.position.y, obj.velocity.x, obj.velocity.y };
+        unsigned char bytes[sizeof(values)];
+        std::memcpy(bytes, values, sizeof(values));
+        for (const unsigned char byte : bytes) {
+            hash = (hash ^ byte) * 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+static double getElapsedMs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv)
+{
+    HeadlessConfig config;
+    if (!parseArguments(argc, argv, config)) {
+        printUsage();
+        return 1;
+    }
+
+    if (!config.threads) {
+        config.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    tp::ThreadPool thread_pool(config.threads);
+    thread_pool.m_grain_size = config.grain;
+    thread_pool.m_spin_count = config.spin;
+    if (config.pin) {
+        const tp::CpuTopology topology = tp::CpuTopology::discover();
+        const bool pinned = thread_pool.pin(topology);
+        std::printf("topology: %zu cpus, %u cores, %zu nodes, workers %s on %u nodes\n", topology.cpus.size(), topology.getCoreCount(),
+                    topology.getNodes().size(), pinned ? "pinned" : "not pinned", thread_pool.m_node_count);
+    }
+    const IVec2 world_size{ config.world, config.world };
+    PhysicSolver solver{ world_size, config.view_range, thread_pool };
+    solver.seed = config.seed;
+    solver.reorder_period = config.reorder;
+    solver.symmetric_contacts = config.symmetric;
+    solver.incremental_grid = config.incremental;
+    solver.pipelined_update = config.pipeline;
+    solver.obstacle_field_resolution = config.field;
+    Scenario::loadDefault(solver, config.agents);
+
+    std::printf("objects %llu, obstacles %u, threads %u, world %d, view range %u, seed %u, reorder %u, field %u, grain %u%s%s%s\n",
+                static_cast<unsigned long long>(solver.objects.size()), solver.obstacles.size(), config.threads, config.world, config.view_range, config.seed, config.reorder, config.field, config.grain,
+                config.symmetric ? ", symmetric" : "", config.incremental ? ", incremental" : "", config.pipeline ? ", pipelined" : "");
+    if (!config.quiet) {
+        std::printf("step,grid_ms,neighbours_ms,integration_ms,total_ms\n");
+    }
+
+    Profiler& profiler = Profiler::getInstance();
+    profiler.setEnabled(!config.trace_path.empty());
+
+    const float dt = 1.0f / 60.0f;
+    double grid_total        = 0.0;
+    double neighbours_total  = 0.0;
+    double integration_total = 0.0;
+    for (uint32_t step{ 0 }; step < config.steps; ++step) {
+        auto start = std::chrono::steady_clock::now();
+        solver.addObjectsToGrid();
+        const double grid_ms = getElapsedMs(start);
+
+        // Pipelined steps have no separate integration, it is counted with the neighbours
+        start = std::chrono::steady_clock::now();
+        if (config.pipeline) {
+            solver.solveAndIntegrate(dt);
+        }
+        else {
+            solver.solveNeighborhood();
+        }
+        const double neighbours_ms = getElapsedMs(start);
+
+        start = std::chrono::steady_clock::now();
+        if (!config.pipeline) {
+            solver.updateObjects_multi(dt);
+        }
+        const double integration_ms = getElapsedMs(start);
+
+        grid_total        += grid_ms;
+        neighbours_total  += neighbours_ms;
+        integration_total += integration_ms;
+        if (!config.quiet) {
+            std::printf("%u,%.3f,%.3f,%.3f,%.3f\n", step, grid_ms, neighbours_ms, integration_ms, grid_ms + neighbours_ms + integration_ms);
+        }
+    }
+
+    const double steps = std::max(1u, config.steps);
+    std::printf("mean step: grid %.3f ms, neighbours %.3f ms, integration %.3f ms, total %.3f ms\n",
+                grid_total / steps, neighbours_total / steps, integration_total / steps,
+                (grid_total + neighbours_total + integration_total) / steps);
+    const tp::IdleStats idle = thread_pool.getIdleStats();
+    std::printf("worker idle: spinning %.3f ms, parked %.3f ms, %llu parks\n",
+                idle.spin_ms, idle.park_ms, static_cast<unsigned long long>(idle.parks));
+    std::printf("state hash %016llx\n", static_cast<unsigned long long>(getStateHash(solver)));
+
+    if (profiler.isEnabled()) {
+        std::printf("%-20s %8s %10s %10s %10s %10s\n", "span", "count", "mean_ms", "p50_ms", "p99_ms", "max_ms");
+        for (const char* name : profiler.getNames()) {
+            const Profiler::Stats stats = profiler.getStats(name);
+            std::printf("%-20s %8llu %10.3f %10.3f %10.3f %10.3f\n", name, static_cast<unsigned long long>(stats.count),
+                        stats.mean_ms, stats.p50_ms, stats.p99_ms, stats.max_ms);
+        }
+        if (!profiler.exportChromeTrace(config.trace_path)) {
+            std::cout << "Cannot write " << config.trace_path << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
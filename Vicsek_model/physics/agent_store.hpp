@@ -0,0 +1,63 @@
+#pragma once
+#include <vector>
+#include <initializer_list>
+#include <cstdint>
+
+#include "physic_object.hpp"
+#include "../thread_pool/numa.hpp"
+
+
+// Structure of arrays copy of the PhysicObject fields read by the neighbour search.
+// Objects stay the owners of the simulation state, the store is refreshed from them
+// once per frame so the neighbour kernel streams only the bytes it needs.
+// Grown elements are left uninitialised, see PhysicSolver::resizeObjectArrays.
+struct AgentStore
+{
+    tp::FirstTouchVector<double> x;
+    tp::FirstTouchVector<double> y;
+    tp::FirstTouchVector<double> vx;
+    tp::FirstTouchVector<double> vy;
+    tp::FirstTouchVector<double> annealing;
+    tp::FirstTouchVector<Role>   role;
+
+    // Only reallocates when the number of objects grows. Values are not kept, so a
+    // reallocation copies nothing and the new pages are first touched by the caller's fill.
+    void resize(uint32_t count)
+    {
+        if (x.size() == count) {
+            return;
+        }
+        for (auto* values : { &x, &y, &vx, &vy, &annealing }) {
+            values->clear();
+            values->resize(count);
+        }
+        role.clear();
+        role.resize(count);
+    }
+
+    void reset(uint32_t i)
+    {
+        x[i]         = 0.0;
+        y[i]         = 0.0;
+        vx[i]        = 0.0;
+        vy[i]        = 0.0;
+        annealing[i] = 0.0;
+        role[i]      = Role::Searching;
+    }
+
+    void store(uint32_t i, const PhysicObject& obj)
+    {
+        x[i]         = obj.position.x;
+        y[i]         = obj.position.y;
+        vx[i]        = obj.velocity.x;
+        vy[i]        = obj.velocity.y;
+        annealing[i] = obj.annealingTime;
+        role[i]      = obj.role;
+    }
+
+    [[nodiscard]]
+    uint32_t size() const
+    {
+        return static_cast<uint32_t>(x.size());
+    }
+};
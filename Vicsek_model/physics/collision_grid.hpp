@@ -1,90 +1,310 @@
 #pragma once
-#include <list>
+#include <vector>
+#include <algorithm>
 #include <cstdint>
+#include <cmath>
 
 #include "../engine/common/vec.hpp"
-#include "../engine/common/grid.hpp"
+#include "../thread_pool/numa.hpp"
 
 struct PhysicObject;
 
+// View on the contiguous range of object indices stored in one cell
 struct CollisionCell
 {
+	const uint32_t* objects = nullptr;
 	uint32_t objects_count = 0;
-	std::list<uint32_t> objects;
 
+	const uint32_t* begin() const
+	{
+		return objects;
+	}
+
+	const uint32_t* end() const
+	{
+		return objects + objects_count;
+	}
+};
+
+// Flat cell index rebuilt every frame with a two-level counting sort.
+// cell_count holds the number of objects in each cell and cell_start the offset
+// of its first object index in the contiguous `objects` array.
+// Columns are grouped in buckets (a few per thread). Objects are split in slices, each
+// slice only counts its objects per bucket, then the objects are binned by bucket and
+// every bucket sorts its own objects into its cells. The histograms stay small whatever
+// the cell count, and the objects of a cell keep their ascending index order.
+// Cells are stored with a one cell halo, (width + 2) x (height + 2) column major:
+// halo cells never receive objects, updateHalo makes them alias the opposite border
+// so a neighbour is always the cell id plus a constant offset, without wrapping.
+// With slack slots each cell reserves extra room after its objects, so objects that
+// change cell can be moved incrementally (swap-remove then append) until a cell is full.
+struct CollisionGrid
+{
+	static constexpr uint32_t invalid_cell = 0xFFFFFFFF;
+
+	int32_t  width  = 0;
+	int32_t  height = 0;
+	uint32_t cell_size = 1;
+
+	std::vector<uint32_t> cell_start;
+	std::vector<uint32_t> cell_count;
+	std::vector<uint32_t> cell_capacity;
+	// Slots of the cells, column by column. Grown by PhysicSolver::reserveGridObjects.
+	tp::FirstTouchVector<uint32_t> objects;
+	// Position in `objects` of every object index
+	tp::FirstTouchVector<uint32_t> object_slot;
+	// Cell of every object index, invalid_cell when it is outside the grid
+	tp::FirstTouchVector<uint32_t> object_cell;
+	// Free slots reserved per cell on top of half its count, 0 packs the cells
+	uint32_t              slack_slots = 0;
 
-	CollisionCell() = default;
+	// Buckets per slice, more buckets than threads balance the per bucket sort
+	static constexpr uint32_t buckets_per_slice = 4;
+	uint32_t              slice_count  = 1;
+	uint32_t              bucket_count = 1;
+	// Cells of a bucket, a whole number of columns halo included
+	uint32_t              bucket_cells = 1;
+	// slice_count rows of per bucket counts, then turned into binning cursors
+	std::vector<uint32_t> slice_cursor;
+	// Objects of bucket i are binned in [bucket_start[i], bucket_start[i + 1])
+	std::vector<uint32_t> bucket_start;
+	// Binned objects and their cell, in index order inside a bucket
+	tp::FirstTouchVector<uint32_t> binned_objects;
+	tp::FirstTouchVector<uint32_t> binned_cells;
 
-	void addAtom(uint32_t id)
+
+	CollisionGrid() = default;
+
+	// Grid is divided into cells of a specific size
+	CollisionGrid(int32_t world_width, int32_t world_height, uint32_t cell_size_)
+		: width(std::ceil((float)world_width / cell_size_)), height(std::ceil((float)world_height / cell_size_)),	//std::ceil to zaokrglenie w gr
+		cell_size{ cell_size_ },
+		cell_start(getCellCount(), 0),
+		cell_count(getCellCount(), 0),
+		cell_capacity(getCellCount(), 0)
 	{
-		objects.push_back(id);
-		objects_count++;
+		setSliceCount(1);
 	}
 
-	void clear()
+	void setSliceCount(uint32_t count)
 	{
-		objects.clear();
-		objects_count = 0u;
+		const uint32_t columns        = static_cast<uint32_t>(width + 2);
+		const uint32_t bucket_columns = (columns + count * buckets_per_slice - 1) / (count * buckets_per_slice);
+		slice_count  = count;
+		bucket_cells = bucket_columns * static_cast<uint32_t>(height + 2);
+		bucket_count = (columns + bucket_columns - 1) / bucket_columns;
+		slice_cursor.assign(static_cast<size_t>(count) * bucket_count, 0);
+		bucket_start.assign(bucket_count + 1, 0);
 	}
 
-	void remove(uint32_t id)
+	// Number of cells, halo included
+	[[nodiscard]]
+	uint32_t getCellCount() const
 	{
+		return static_cast<uint32_t>((width + 2) * (height + 2));
+	}
 
-		objects.remove_if([id](const uint32_t& element_id) {
-			return element_id == id;
-		});
+	// Id of the cell at column x and row y, -1 and width (or height) address the halo
+	[[nodiscard]]
+	uint32_t getCellIndex(int32_t x, int32_t y) const
+	{
+		return static_cast<uint32_t>((x + 1) * (height + 2) + (y + 1));
 	}
-};
 
-struct CollisionGrid : public Grid<CollisionCell>
-{
-	uint32_t cell_size;
+	[[nodiscard]]
+	uint32_t getCellId(uint32_t pos_x, uint32_t pos_y) const
+	{
+		const uint32_t cell_x_id = (pos_x / cell_size);
+		const uint32_t cell_y_id = (pos_y / cell_size);
 
-	CollisionGrid()
-		: Grid<CollisionCell>()
-	{}
+		return getCellIndex(cell_x_id, cell_y_id);
+	}
 
-	// Grid is divided into cells of a specific size
-	CollisionGrid(int32_t world_width, int32_t world_height, uint32_t cell_size_)
-		: Grid<CollisionCell>(std::ceil((float)world_width / cell_size_), std::ceil((float)world_height / cell_size_)),	//std::ceil to zaokrglenie w gr
-		cell_size{ cell_size_ }
-	{}
+	[[nodiscard]]
+	CollisionCell getCell(uint32_t cell_id) const
+	{
+		return { objects.data() + cell_start[cell_id], cell_count[cell_id] };
+	}
 
-	bool updateAtomCell(uint32_t pos_x, uint32_t pos_y, uint32_t atom, uint32_t& atom_cell_id)
+	// Cell at (x + dx, y + dy) with periodic wrapping through the halo, for dx and dy in [-1, 1]
+	[[nodiscard]]
+	CollisionCell getNeighbourCell(uint32_t x, uint32_t y, int32_t dx, int32_t dy) const
 	{
-		uint32_t cell_x_id = (pos_x / cell_size);
-		uint32_t cell_y_id = (pos_y / cell_size);
+		return getCell(getCellIndex(x, y) + dx * (height + 2) + dy);
+	}
 
-		const uint32_t id = cell_x_id * height + cell_y_id;
+	uint32_t* getSliceRow(uint32_t slice)
+	{
+		return slice_cursor.data() + static_cast<size_t>(slice) * bucket_count;
+	}
 
-		// Update atom_cell whitch is used in cleaning grid in main loop 
-		atom_cell_id = id;
-		
-		// Add to grid
-		data[id].addAtom(atom);
-		return true;
+	[[nodiscard]]
+	uint32_t getBucket(uint32_t cell_id) const
+	{
+		return cell_id / bucket_cells;
 	}
 
-	bool addAtom(uint32_t pos_x, uint32_t pos_y, uint32_t atom)
+	[[nodiscard]]
+	uint32_t getBucketCellsStart(uint32_t bucket) const
 	{
-		uint32_t cell_x_id = (pos_x / cell_size);
-		uint32_t cell_y_id = (pos_y / cell_size);
+		return bucket * bucket_cells;
+	}
 
-		const uint32_t id = cell_x_id * height + cell_y_id;
-		// Add to grid
-		data[id].addAtom(atom);
-		return true;
+	[[nodiscard]]
+	uint32_t getBucketCellsEnd(uint32_t bucket) const
+	{
+		return std::min((bucket + 1) * bucket_cells, getCellCount());
+	}
+
+	// First pass: reset and count the objects of every bucket, for one slice
+	void clearSlice(uint32_t slice)
+	{
+		uint32_t* row = getSliceRow(slice);
+		std::fill(row, row + bucket_count, 0u);
 	}
 
-	void clear()
+	void countAtom(uint32_t slice, uint32_t cell_id)
 	{
-		for (auto& c : data) {
-			c.clear();
+		++getSliceRow(slice)[getBucket(cell_id)];
+	}
+
+	// Exclusive prefix sum of the buckets, slice after slice inside a bucket so the binned
+	// objects stay in index order. Slices counts become their binning cursors, returns the
+	// number of binned objects.
+	uint32_t computeBucketStarts()
+	{
+		uint32_t offset = 0;
+		for (uint32_t b{ 0 }; b < bucket_count; ++b) {
+			bucket_start[b] = offset;
+			for (uint32_t s{ 0 }; s < slice_count; ++s) {
+				uint32_t& cursor = getSliceRow(s)[b];
+				const uint32_t count = cursor;
+				cursor = offset;
+				offset += count;
+			}
 		}
+		bucket_start[bucket_count] = offset;
+		return offset;
 	}
 
-	void clear(uint32_t cell_id)
+	// Second pass: bin object indices by bucket, in insertion order
+	void binAtom(uint32_t slice, uint32_t cell_id, uint32_t atom)
 	{
-		data[cell_id].clear();
+		const uint32_t index = getSliceRow(slice)[getBucket(cell_id)]++;
+		binned_objects[index] = atom;
+		binned_cells[index]   = cell_id;
+	}
+
+	// Slots reserved for a cell holding `count` objects
+	[[nodiscard]]
+	uint32_t getCapacity(uint32_t count) const
+	{
+		return slack_slots ? count + count / 2 + slack_slots : count;
+	}
+
+	// Third pass, per bucket: counts the objects of its cells, returns the number of slots of the bucket
+	uint32_t countBucket(uint32_t bucket)
+	{
+		const uint32_t start = getBucketCellsStart(bucket);
+		const uint32_t end   = getBucketCellsEnd(bucket);
+		std::fill(cell_count.begin() + start, cell_count.begin() + end, 0u);
+		for (uint32_t k{ bucket_start[bucket] }; k < bucket_start[bucket + 1]; ++k) {
+			++cell_count[binned_cells[k]];
+		}
+		uint32_t total = 0;
+		for (uint32_t i{ start }; i < end; ++i) {
+			cell_capacity[i] = getCapacity(cell_count[i]);
+			total += cell_capacity[i];
+		}
+		return total;
+	}
+
+	// Last pass, per bucket: cell starts from `offset` then scatter of the binned objects.
+	// The halo has to be updated afterwards.
+	void fillBucket(uint32_t bucket, uint32_t offset)
+	{
+		for (uint32_t i{ getBucketCellsStart(bucket) }; i < getBucketCellsEnd(bucket); ++i) {
+			cell_start[i] = offset;
+			cell_count[i] = 0;
+			offset += cell_capacity[i];
+		}
+		for (uint32_t k{ bucket_start[bucket] }; k < bucket_start[bucket + 1]; ++k) {
+			const uint32_t cell_id = binned_cells[k];
+			const uint32_t atom    = binned_objects[k];
+			const uint32_t slot    = cell_start[cell_id] + cell_count[cell_id]++;
+			objects[slot]     = atom;
+			object_slot[atom] = slot;
+			object_cell[atom] = cell_id;
+		}
+	}
+
+	// Index in `objects` of the first object of column x, x == width gives the objects count
+	[[nodiscard]]
+	uint32_t getColumnStart(int32_t x) const
+	{
+		if (x < width) {
+			return cell_start[getCellIndex(x, 0)];
+		}
+		const uint32_t last = getCellIndex(width - 1, height - 1);
+		return cell_start[last] + cell_count[last];
+	}
+
+	// Calls callback(halo_cell, interior_cell) for every halo cell and the opposite interior cell it aliases,
+	// corners included (the row halo is done first so the column halo copies corners from it)
+	template<typename TCallback>
+	void forEachHaloCell(TCallback&& callback) const
+	{
+		for (int32_t x{ 0 }; x < width; ++x) {
+			callback(getCellIndex(x, -1), getCellIndex(x, height - 1));
+			callback(getCellIndex(x, height), getCellIndex(x, 0));
+		}
+		for (int32_t y{ -1 }; y <= height; ++y) {
+			callback(getCellIndex(-1, y), getCellIndex(width - 1, y));
+			callback(getCellIndex(width, y), getCellIndex(0, y));
+		}
+	}
+
+	// Halo cells take the span of the opposite interior cell, corners included.
+	// Has to run once the cell starts and counts are final.
+	void updateHalo()
+	{
+		forEachHaloCell([this](uint32_t destination, uint32_t source) {
+			copyCell(destination, source);
+		});
+	}
+
+	void copyCell(uint32_t destination, uint32_t source)
+	{
+		cell_start[destination] = cell_start[source];
+		cell_count[destination] = cell_count[source];
+	}
+
+	// Objects outside the grid are only recorded as such
+	void insertStray(uint32_t atom)
+	{
+		object_cell[atom] = invalid_cell;
+	}
+
+	// Incremental update: the last object of the cell takes the place of the removed one
+	void removeAtom(uint32_t cell_id, uint32_t atom)
+	{
+		const uint32_t slot = object_slot[atom];
+		const uint32_t last = objects[cell_start[cell_id] + --cell_count[cell_id]];
+		objects[slot]     = last;
+		object_slot[last] = slot;
+		object_cell[atom] = invalid_cell;
+	}
+
+	// Incremental update: appends the object to the cell, false if the cell is full
+	bool addAtom(uint32_t cell_id, uint32_t atom)
+	{
+		if (cell_count[cell_id] == cell_capacity[cell_id]) {
+			return false;
+		}
+		const uint32_t slot = cell_start[cell_id] + cell_count[cell_id]++;
+		objects[slot]     = atom;
+		object_slot[atom] = slot;
+		object_cell[atom] = cell_id;
+		return true;
 	}
 };
\ No newline at end of file
@@ -0,0 +1,429 @@
+#pragma once
+#include <cstdint>
+#include <array>
+#include <utility>
+#include <algorithm>
+
+// VICSEK_SCALAR_CONTACT forces the scalar fallback
+#if !defined(VICSEK_SCALAR_CONTACT)
+    #if defined(__AVX2__)
+        #define VICSEK_CONTACT_AVX2
+    #elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        #define VICSEK_CONTACT_SSE2
+    #endif
+#endif
+
+#if defined(VICSEK_CONTACT_AVX2) || defined(VICSEK_CONTACT_SSE2)
+    #include <immintrin.h>
+#endif
+
+#include "agent_store.hpp"
+#include "environment.hpp"
+#include "roles.hpp"
+
+
+// Batched neighbour interaction: one agent against a contiguous span of neighbour indices
+// that all have the same role. A kernel is generated for every (role, neighbour role) pair
+// from the interaction table, so the lanes run without role tests and pairs that do not
+// interact cost nothing. Each lane performs the same operations as Environment::solveContact
+// and contributions are accumulated in neighbour order, so the result is bit-identical
+// to the scalar path over the same span.
+struct ContactKernel
+{
+    using Kernel = void (*)(const AgentStore&, uint32_t, const uint32_t*, uint32_t, Vec2&, double);
+
+    static void solve(Role role, Role neighbour_role, const AgentStore& agents, uint32_t atom, const uint32_t* ids, uint32_t count, Vec2& next_velocity, double view_range)
+    {
+        getKernel(role, neighbour_role)(agents, atom, ids, count, next_velocity, view_range);
+    }
+
+    // Kernel of every (role, neighbour role) pair, pair index is role * role_count + neighbour role
+    template<std::size_t... TPair>
+    static constexpr std::array<Kernel, role_count * role_count> makeKernels(std::index_sequence<TPair...>)
+    {
+        return { &solveRoles<getRole(TPair / role_count), getRole(TPair % role_count)>... };
+    }
+
+    static Kernel getKernel(Role role, Role neighbour_role)
+    {
+        static constexpr std::array<Kernel, role_count * role_count> kernels = makeKernels(std::make_index_sequence<role_count * role_count>{});
+        return kernels[getRoleIndex(role) * role_count + getRoleIndex(neighbour_role)];
+    }
+
+    template<Role TRole, Role TNeighbour>
+    static void solveRoles(const AgentStore& agents, uint32_t atom, const uint32_t* ids, uint32_t count, Vec2& next_velocity, double view_range)
+    {
+        if constexpr (getInteraction(TRole, TNeighbour) != Interaction::None) {
+#if defined(VICSEK_CONTACT_AVX2)
+            solveRolesAVX2<getInteraction(TRole, TNeighbour)>(agents, atom, ids, count, next_velocity, view_range);
+#elif defined(VICSEK_CONTACT_SSE2)
+            solveRolesSSE2<getInteraction(TRole, TNeighbour)>(agents, atom, ids, count, next_velocity, view_range);
+#else
+            solveScalar(agents, atom, ids, count, next_velocity, view_range);
+#endif
+        }
+    }
+
+    static void solveScalar(const AgentStore& agents, uint32_t atom, const uint32_t* ids, uint32_t count, Vec2& next_velocity, double view_range)
+    {
+        Environment& environment = Environment::getInstance();
+        for (uint32_t k{ 0 }; k < count; ++k) {
+            environment.solveContact(agents, atom, ids[k], next_velocity, view_range);
+        }
+    }
+
+    // Adds the active lanes contributions in lane order, which is the neighbours order
+    static void accumulate(int32_t active, const double* cx, const double* cy, Vec2& next_velocity)
+    {
+        for (uint32_t lane{ 0 }; active; ++lane, active >>= 1) {
+            if (active & 1) {
+                next_velocity.x += cx[lane];
+                next_velocity.y += cy[lane];
+            }
+        }
+    }
+
+#if defined(VICSEK_CONTACT_AVX2)
+    template<Interaction TInteraction>
+    static void solveRolesAVX2(const AgentStore& agents, uint32_t atom, const uint32_t* ids, uint32_t count, Vec2& next_velocity, double view_range)
+    {
+        const __m256d x_1       = _mm256_set1_pd(agents.x[atom]);
+        const __m256d y_1       = _mm256_set1_pd(agents.y[atom]);
+        const __m256d eps       = _mm256_set1_pd(0.0001);
+        const __m256d range_2   = _mm256_set1_pd(view_range * view_range);
+        const __m256d repulsion = _mm256_set1_pd(1000.0);
+        const __m256d sign      = _mm256_set1_pd(-0.0);
+
+        alignas(32) double cx[4];
+        alignas(32) double cy[4];
+
+        uint32_t k{ 0 };
+        for (; k + 4 <= count; k += 4) {
+            const __m128i idx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ids + k));
+
+            const __m256d dx  = _mm256_sub_pd(x_1, _mm256_i32gather_pd(agents.x.data(), idx, 8));
+            const __m256d dy  = _mm256_sub_pd(y_1, _mm256_i32gather_pd(agents.y.data(), idx, 8));
+            const __m256d sqr = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+
+            const int32_t active = _mm256_movemask_pd(_mm256_and_pd(_mm256_cmp_pd(sqr, range_2, _CMP_LT_OQ), _mm256_cmp_pd(sqr, eps, _CMP_GT_OQ)));
+            if (!active) {
+                continue;
+            }
+
+            if constexpr (TInteraction == Interaction::Repulsion) {
+                const __m256d factor = _mm256_div_pd(repulsion, sqr);
+                _mm256_store_pd(cx, _mm256_mul_pd(dx, factor));
+                _mm256_store_pd(cy, _mm256_mul_pd(dy, factor));
+            }
+            else {
+                // Neighbour weighted velocity, subtracted
+                const __m256d annealing = _mm256_i32gather_pd(agents.annealing.data(), idx, 8);
+                _mm256_store_pd(cx, _mm256_xor_pd(_mm256_mul_pd(_mm256_i32gather_pd(agents.vx.data(), idx, 8), annealing), sign));
+                _mm256_store_pd(cy, _mm256_xor_pd(_mm256_mul_pd(_mm256_i32gather_pd(agents.vy.data(), idx, 8), annealing), sign));
+            }
+            accumulate(active, cx, cy, next_velocity);
+        }
+
+        solveScalar(agents, atom, ids + k, count - k, next_velocity, view_range);
+    }
+#endif
+
+#if defined(VICSEK_CONTACT_SSE2)
+    template<Interaction TInteraction>
+    static void solveRolesSSE2(const AgentStore& agents, uint32_t atom, const uint32_t* ids, uint32_t count, Vec2& next_velocity, double view_range)
+    {
+        const __m128d x_1       = _mm_set1_pd(agents.x[atom]);
+        const __m128d y_1       = _mm_set1_pd(agents.y[atom]);
+        const __m128d eps       = _mm_set1_pd(0.0001);
+        const __m128d range_2   = _mm_set1_pd(view_range * view_range);
+        const __m128d repulsion = _mm_set1_pd(1000.0);
+        const __m128d sign      = _mm_set1_pd(-0.0);
+        const double* x         = agents.x.data();
+        const double* y         = agents.y.data();
+
+        alignas(16) double cx[2];
+        alignas(16) double cy[2];
+
+        uint32_t k{ 0 };
+        for (; k + 2 <= count; k += 2) {
+            const uint32_t i_0 = ids[k];
+            const uint32_t i_1 = ids[k + 1];
+
+            const __m128d dx  = _mm_sub_pd(x_1, _mm_set_pd(x[i_1], x[i_0]));
+            const __m128d dy  = _mm_sub_pd(y_1, _mm_set_pd(y[i_1], y[i_0]));
+            const __m128d sqr = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+
+            const int32_t active = _mm_movemask_pd(_mm_and_pd(_mm_cmplt_pd(sqr, range_2), _mm_cmpgt_pd(sqr, eps)));
+            if (!active) {
+                continue;
+            }
+
+            if constexpr (TInteraction == Interaction::Repulsion) {
+                const __m128d factor = _mm_div_pd(repulsion, sqr);
+                _mm_store_pd(cx, _mm_mul_pd(dx, factor));
+                _mm_store_pd(cy, _mm_mul_pd(dy, factor));
+            }
+            else {
+                // Neighbour weighted velocity, subtracted
+                const __m128d annealing = _mm_set_pd(agents.annealing[i_1], agents.annealing[i_0]);
+                _mm_store_pd(cx, _mm_xor_pd(_mm_mul_pd(_mm_set_pd(agents.vx[i_1], agents.vx[i_0]), annealing), sign));
+                _mm_store_pd(cy, _mm_xor_pd(_mm_mul_pd(_mm_set_pd(agents.vy[i_1], agents.vy[i_0]), annealing), sign));
+            }
+            accumulate(active, cx, cy, next_velocity);
+        }
+
+        solveScalar(agents, atom, ids + k, count - k, next_velocity, view_range);
+    }
+#endif
+
+    // Static obstacles of one cell, coordinates are read contiguously so no gather is needed.
+    // Same accumulation order as Environment::solveObstacleContact over the span.
+    static void solveObstacles(const AgentStore& agents, uint32_t atom, const double* x, const double* y, uint32_t count, Vec2& next_velocity, double view_range)
+    {
+#if defined(VICSEK_CONTACT_AVX2)
+        solveObstaclesAVX2(agents, atom, x, y, count, next_velocity, view_range);
+#elif defined(VICSEK_CONTACT_SSE2)
+        solveObstaclesSSE2(agents, atom, x, y, count, next_velocity, view_range);
+#else
+        solveObstaclesScalar(agents, atom, x, y, count, next_velocity, view_range);
+#endif
+    }
+
+    static void solveObstaclesScalar(const AgentStore& agents, uint32_t atom, const double* x, const double* y, uint32_t count, Vec2& next_velocity, double view_range)
+    {
+        Environment& environment = Environment::getInstance();
+        for (uint32_t k{ 0 }; k < count; ++k) {
+            environment.solveObstacleContact(agents, atom, x[k], y[k], next_velocity, view_range);
+        }
+    }
+
+#if defined(VICSEK_CONTACT_AVX2)
+    static void solveObstaclesAVX2(const AgentStore& agents, uint32_t atom, const double* x, const double* y, uint32_t count, Vec2& next_velocity, double view_range)
+    {
+        if (getInteraction(agents.role[atom], Role::Obstacle) != Interaction::Repulsion) {
+            return;
+        }
+
+        const __m256d x_1       = _mm256_set1_pd(agents.x[atom]);
+        const __m256d y_1       = _mm256_set1_pd(agents.y[atom]);
+        const __m256d eps       = _mm256_set1_pd(0.0001);
+        const __m256d range_2   = _mm256_set1_pd(view_range * view_range);
+        const __m256d repulsion = _mm256_set1_pd(1000.0);
+
+        alignas(32) double cx[4];
+        alignas(32) double cy[4];
+
+        uint32_t k{ 0 };
+        for (; k + 4 <= count; k += 4) {
+            const __m256d dx  = _mm256_sub_pd(x_1, _mm256_loadu_pd(x + k));
+            const __m256d dy  = _mm256_sub_pd(y_1, _mm256_loadu_pd(y + k));
+            const __m256d sqr = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+
+            const int32_t active = _mm256_movemask_pd(_mm256_and_pd(_mm256_cmp_pd(sqr, range_2, _CMP_LT_OQ), _mm256_cmp_pd(sqr, eps, _CMP_GT_OQ)));
+            if (!active) {
+                continue;
+            }
+
+            const __m256d factor = _mm256_div_pd(repulsion, sqr);
+            _mm256_store_pd(cx, _mm256_mul_pd(dx, factor));
+            _mm256_store_pd(cy, _mm256_mul_pd(dy, factor));
+            accumulate(active, cx, cy, next_velocity);
+        }
+
+        solveObstaclesScalar(agents, atom, x + k, y + k, count - k, next_velocity, view_range);
+    }
+#endif
+
+#if defined(VICSEK_CONTACT_SSE2)
+    static void solveObstaclesSSE2(const AgentStore& agents, uint32_t atom, const double* x, const double* y, uint32_t count, Vec2& next_velocity, double view_range)
+    {
+        if (getInteraction(agents.role[atom], Role::Obstacle) != Interaction::Repulsion) {
+            return;
+        }
+
+        const __m128d x_1       = _mm_set1_pd(agents.x[atom]);
+        const __m128d y_1       = _mm_set1_pd(agents.y[atom]);
+        const __m128d eps       = _mm_set1_pd(0.0001);
+        const __m128d range_2   = _mm_set1_pd(view_range * view_range);
+        const __m128d repulsion = _mm_set1_pd(1000.0);
+
+        alignas(16) double cx[2];
+        alignas(16) double cy[2];
+
+        uint32_t k{ 0 };
+        for (; k + 2 <= count; k += 2) {
+            const __m128d dx  = _mm_sub_pd(x_1, _mm_loadu_pd(x + k));
+            const __m128d dy  = _mm_sub_pd(y_1, _mm_loadu_pd(y + k));
+            const __m128d sqr = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+
+            const int32_t active = _mm_movemask_pd(_mm_and_pd(_mm_cmplt_pd(sqr, range_2), _mm_cmpgt_pd(sqr, eps)));
+            if (!active) {
+                continue;
+            }
+
+            const __m128d factor = _mm_div_pd(repulsion, sqr);
+            _mm_store_pd(cx, _mm_mul_pd(dx, factor));
+            _mm_store_pd(cy, _mm_mul_pd(dy, factor));
+            accumulate(active, cx, cy, next_velocity);
+        }
+
+        solveObstaclesScalar(agents, atom, x + k, y + k, count - k, next_velocity, view_range);
+    }
+#endif
+
+    // Symmetric variant: every pair of (atom, ids[k]) is evaluated once and both agents are updated,
+    // next_velocity_of(id) returns the accumulator of a neighbour. As for solve, a kernel is generated
+    // for every (role, neighbour role) pair and runs over a span of neighbours of that role, pairs
+    // interacting neither way cost nothing. Each side gets the contributions of Environment::solveContactPair,
+    // in neighbour order.
+    template<typename TAccess>
+    using SymmetricKernel = void (*)(const AgentStore&, uint32_t, const uint32_t*, uint32_t, Vec2&, double, const TAccess&);
+
+    template<typename TAccess>
+    static void solveSymmetric(Role role, Role neighbour_role, const AgentStore& agents, uint32_t atom, const uint32_t* ids, uint32_t count, Vec2& next_velocity, double view_range, const TAccess& next_velocity_of)
+    {
+        getSymmetricKernel<TAccess>(role, neighbour_role)(agents, atom, ids, count, next_velocity, view_range, next_velocity_of);
+    }
+
+    template<typename TAccess, std::size_t... TPair>
+    static constexpr std::array<SymmetricKernel<TAccess>, role_count * role_count> makeSymmetricKernels(std::index_sequence<TPair...>)
+    {
+        return { &solveSymmetricRoles<getRole(TPair / role_count), getRole(TPair % role_count), TAccess>... };
+    }
+
+    template<typename TAccess>
+    static SymmetricKernel<TAccess> getSymmetricKernel(Role role, Role neighbour_role)
+    {
+        static constexpr std::array<SymmetricKernel<TAccess>, role_count * role_count> kernels = makeSymmetricKernels<TAccess>(std::make_index_sequence<role_count * role_count>{});
+        return kernels[getRoleIndex(role) * role_count + getRoleIndex(neighbour_role)];
+    }
+
+    template<Role TRole, Role TNeighbour, typename TAccess>
+    static void solveSymmetricRoles(const AgentStore& agents, uint32_t atom, const uint32_t* ids, uint32_t count, Vec2& next_velocity, double view_range, const TAccess& next_velocity_of)
+    {
+        constexpr Interaction forward  = getInteraction(TRole, TNeighbour);
+        constexpr Interaction backward = getInteraction(TNeighbour, TRole);
+        if constexpr (forward != Interaction::None || backward != Interaction::None) {
+#if defined(VICSEK_CONTACT_AVX2)
+            solveSymmetricRolesAVX2<forward, backward>(agents, atom, ids, count, next_velocity, view_range, next_velocity_of);
+#elif defined(VICSEK_CONTACT_SSE2)
+            solveSymmetricRolesSSE2<forward, backward>(agents, atom, ids, count, next_velocity, view_range, next_velocity_of);
+#else
+            solveSymmetricScalar(agents, atom, ids, count, next_velocity, view_range, next_velocity_of);
+#endif
+        }
+    }
+
+    template<typename TAccess>
+    static void solveSymmetricScalar(const AgentStore& agents, uint32_t atom, const uint32_t* ids, uint32_t count, Vec2& next_velocity, double view_range, const TAccess& next_velocity_of)
+    {
+        Environment& environment = Environment::getInstance();
+        for (uint32_t k{ 0 }; k < count; ++k) {
+            environment.solveContactPair(agents, atom, ids[k], next_velocity, next_velocity_of(ids[k]), view_range);
+        }
+    }
+
+    // Environment::solveContactPair of an in range pair whose interactions are known
+    template<Interaction TForward, Interaction TBackward>
+    static void addPair(const AgentStore& agents, uint32_t atom_1, uint32_t atom_2, Vec2 o2_o1, double sqr, Vec2& next_velocity_1, Vec2& next_velocity_2)
+    {
+        if constexpr (TForward == Interaction::Repulsion) {
+            next_velocity_1 += o2_o1 * (1000 / sqr);
+        }
+        else if constexpr (TForward == Interaction::Opposition) {
+            const Vec2 velocity_2 = { agents.vx[atom_2], agents.vy[atom_2] };
+            next_velocity_1 -= velocity_2 * agents.annealing[atom_2];
+        }
+        if constexpr (TBackward == Interaction::Repulsion) {
+            next_velocity_2 -= o2_o1 * (1000 / sqr);
+        }
+        else if constexpr (TBackward == Interaction::Opposition) {
+            const Vec2 velocity_1 = { agents.vx[atom_1], agents.vy[atom_1] };
+            next_velocity_2 -= velocity_1 * agents.annealing[atom_1];
+        }
+    }
+
+    // Applies the active lanes pairs in lane order, from the lanes geometry
+    template<Interaction TForward, Interaction TBackward, typename TAccess>
+    static void addPairs(int32_t active, const AgentStore& agents, uint32_t atom, const uint32_t* ids, const double* dx, const double* dy, const double* sqr, Vec2& next_velocity, const TAccess& next_velocity_of)
+    {
+        for (uint32_t lane{ 0 }; active; ++lane, active >>= 1) {
+            if (active & 1) {
+                addPair<TForward, TBackward>(agents, atom, ids[lane], { dx[lane], dy[lane] }, sqr[lane], next_velocity, next_velocity_of(ids[lane]));
+            }
+        }
+    }
+
+#if defined(VICSEK_CONTACT_AVX2)
+    template<Interaction TForward, Interaction TBackward, typename TAccess>
+    static void solveSymmetricRolesAVX2(const AgentStore& agents, uint32_t atom, const uint32_t* ids, uint32_t count, Vec2& next_velocity, double view_range, const TAccess& next_velocity_of)
+    {
+        const __m256d x_1     = _mm256_set1_pd(agents.x[atom]);
+        const __m256d y_1     = _mm256_set1_pd(agents.y[atom]);
+        const __m256d eps     = _mm256_set1_pd(0.0001);
+        const __m256d range_2 = _mm256_set1_pd(view_range * view_range);
+
+        alignas(32) double dx_lanes[4];
+        alignas(32) double dy_lanes[4];
+        alignas(32) double sqr_lanes[4];
+
+        uint32_t k{ 0 };
+        for (; k + 4 <= count; k += 4) {
+            const __m128i idx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ids + k));
+
+            const __m256d dx  = _mm256_sub_pd(x_1, _mm256_i32gather_pd(agents.x.data(), idx, 8));
+            const __m256d dy  = _mm256_sub_pd(y_1, _mm256_i32gather_pd(agents.y.data(), idx, 8));
+            const __m256d sqr = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+
+            const int32_t active = _mm256_movemask_pd(_mm256_and_pd(_mm256_cmp_pd(sqr, range_2, _CMP_LT_OQ), _mm256_cmp_pd(sqr, eps, _CMP_GT_OQ)));
+            if (!active) {
+                continue;
+            }
+            _mm256_store_pd(dx_lanes, dx);
+            _mm256_store_pd(dy_lanes, dy);
+            _mm256_store_pd(sqr_lanes, sqr);
+            addPairs<TForward, TBackward>(active, agents, atom, ids + k, dx_lanes, dy_lanes, sqr_lanes, next_velocity, next_velocity_of);
+        }
+
+        solveSymmetricScalar(agents, atom, ids + k, count - k, next_velocity, view_range, next_velocity_of);
+    }
+#endif
+
+#if defined(VICSEK_CONTACT_SSE2)
+    template<Interaction TForward, Interaction TBackward, typename TAccess>
+    static void solveSymmetricRolesSSE2(const AgentStore& agents, uint32_t atom, const uint32_t* ids, uint32_t count, Vec2& next_velocity, double view_range, const TAccess& next_velocity_of)
+    {
+        const __m128d x_1     = _mm_set1_pd(agents.x[atom]);
+        const __m128d y_1     = _mm_set1_pd(agents.y[atom]);
+        const __m128d eps     = _mm_set1_pd(0.0001);
+        const __m128d range_2 = _mm_set1_pd(view_range * view_range);
+        const double* x       = agents.x.data();
+        const double* y       = agents.y.data();
+
+        alignas(16) double dx_lanes[2];
+        alignas(16) double dy_lanes[2];
+        alignas(16) double sqr_lanes[2];
+
+        uint32_t k{ 0 };
+        for (; k + 2 <= count; k += 2) {
+            const uint32_t i_0 = ids[k];
+            const uint32_t i_1 = ids[k + 1];
+
+            const __m128d dx  = _mm_sub_pd(x_1, _mm_set_pd(x[i_1], x[i_0]));
+            const __m128d dy  = _mm_sub_pd(y_1, _mm_set_pd(y[i_1], y[i_0]));
+            const __m128d sqr = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+
+            const int32_t active = _mm_movemask_pd(_mm_and_pd(_mm_cmplt_pd(sqr, range_2), _mm_cmpgt_pd(sqr, eps)));
+            if (!active) {
+                continue;
+            }
+            _mm_store_pd(dx_lanes, dx);
+            _mm_store_pd(dy_lanes, dy);
+            _mm_store_pd(sqr_lanes, sqr);
+            addPairs<TForward, TBackward>(active, agents, atom, ids + k, dx_lanes, dy_lanes, sqr_lanes, next_velocity, next_velocity_of);
+        }
+
+        solveSymmetricScalar(agents, atom, ids + k, count - k, next_velocity, view_range, next_velocity_of);
+    }
+#endif
+};
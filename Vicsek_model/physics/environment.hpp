@@ -5,6 +5,7 @@
 
 #include "collision_grid.hpp"
 #include "physic_object.hpp"
+#include "agent_store.hpp"
 
 struct Environment
 {
@@ -20,49 +21,88 @@ public:
         return instance;
     }
 
-    void solveContact(PhysicObject& obj_1, PhysicObject& obj_2, double cell_size)
+    // Accumulates in next_velocity the influence of agent 2 on agent 1, both read from the agents store
+    void solveContact(const AgentStore& agents, uint32_t atom_1, uint32_t atom_2, Vec2& next_velocity, double cell_size)
     {
         constexpr double eps = 0.0001;
 
 
-        const Vec2 o2_o1 = obj_1.position - obj_2.position;
+        const Vec2 o2_o1 = { agents.x[atom_1] - agents.x[atom_2], agents.y[atom_1] - agents.y[atom_2] };
 
         const double sqrDst = o2_o1.x * o2_o1.x + o2_o1.y * o2_o1.y;
-        const double dist = sqrt(sqrDst);
         const double view_range = cell_size;
 
-        if (dist < view_range && sqrDst > eps) {
-            if (obj_1.role == 'S') {
-                if (obj_2.role == 'O') {
-                    obj_1.nextVelocity += o2_o1 * (1000 / sqrDst);
-                }
-                else if (obj_2.role == 'S') {
-                    //obj_1.nextVelocity += obj_2.velocity;
-                }
+        // Squared distances comparison, no sqrt needed
+        if (sqrDst < view_range * view_range && sqrDst > eps) {
+            const Interaction interaction = getInteraction(agents.role[atom_1], agents.role[atom_2]);
+            if (interaction == Interaction::Repulsion) {
+                next_velocity += o2_o1 * (1000 / sqrDst);
             }
-            else if (obj_1.role == 'Z') {
-                if (obj_2.role == 'O') {
-                    obj_1.nextVelocity += o2_o1 * (1000 / sqrDst);
-                }
-                else if (obj_2.role == 'C') {
-                    obj_1.nextVelocity -= obj_2.velocity * obj_2.annealingTime;
-                }
-                else if (obj_2.role == 'Z') {
-                    //obj_1.nextVelocity += obj_2.velocity;
-                }
+            else if (interaction == Interaction::Opposition) {
+                const Vec2 velocity_2 = { agents.vx[atom_2], agents.vy[atom_2] };
+                next_velocity -= velocity_2 * agents.annealing[atom_2];
             }
-            else if (obj_1.role == 'C') {
-                if (obj_2.role == 'O') {
-                    obj_1.nextVelocity += o2_o1 * (1000 / sqrDst);
-                }
-                else if (obj_2.role == 'Z') {
-                    obj_1.nextVelocity -= obj_2.velocity * obj_2.annealingTime;
-                }
-                else if (obj_2.role == 'C') {
-                   // obj_1.nextVelocity += obj_2.velocity;
-                }
+        }
+    }
+
+    // Accumulates the influence of agents 1 and 2 on each other, the pair geometry is computed once.
+    // Each side gets the same contribution as solveContact called from that side.
+    void solveContactPair(const AgentStore& agents, uint32_t atom_1, uint32_t atom_2, Vec2& next_velocity_1, Vec2& next_velocity_2, double cell_size)
+    {
+        constexpr double eps = 0.0001;
+
+
+        const Vec2 o2_o1 = { agents.x[atom_1] - agents.x[atom_2], agents.y[atom_1] - agents.y[atom_2] };
+
+        const double sqrDst = o2_o1.x * o2_o1.x + o2_o1.y * o2_o1.y;
+        const double view_range = cell_size;
+
+        if (sqrDst < view_range * view_range && sqrDst > eps) {
+            const Role role_1 = agents.role[atom_1];
+            const Role role_2 = agents.role[atom_2];
+
+            const Interaction interaction_1 = getInteraction(role_1, role_2);
+            if (interaction_1 == Interaction::Repulsion) {
+                next_velocity_1 += o2_o1 * (1000 / sqrDst);
+            }
+            else if (interaction_1 == Interaction::Opposition) {
+                const Vec2 velocity_2 = { agents.vx[atom_2], agents.vy[atom_2] };
+                next_velocity_1 -= velocity_2 * agents.annealing[atom_2];
+            }
+
+            const Interaction interaction_2 = getInteraction(role_2, role_1);
+            if (interaction_2 == Interaction::Repulsion) {
+                next_velocity_2 -= o2_o1 * (1000 / sqrDst);
+            }
+            else if (interaction_2 == Interaction::Opposition) {
+                const Vec2 velocity_1 = { agents.vx[atom_1], agents.vy[atom_1] };
+                next_velocity_2 -= velocity_1 * agents.annealing[atom_1];
             }
-            
+        }
+    }
+
+    // Accumulates in next_velocity the repulsion of a static obstacle at (x_2, y_2) on the agent,
+    // as solveContact does for an obstacle object. Obstacles do not influence obstacles.
+    void solveObstacleContact(const AgentStore& agents, uint32_t atom, double x_2, double y_2, Vec2& next_velocity, double cell_size)
+    {
+        if (getInteraction(agents.role[atom], Role::Obstacle) == Interaction::Repulsion) {
+            addObstacleRepulsion({ agents.x[atom], agents.y[atom] }, x_2, y_2, next_velocity, cell_size);
+        }
+    }
+
+    // Repulsion of a static obstacle at (x_2, y_2) on any point, also used to bake the obstacle field
+    void addObstacleRepulsion(Vec2 position, double x_2, double y_2, Vec2& force, double cell_size)
+    {
+        constexpr double eps = 0.0001;
+
+
+        const Vec2 o2_o1 = { position.x - x_2, position.y - y_2 };
+
+        const double sqrDst = o2_o1.x * o2_o1.x + o2_o1.y * o2_o1.y;
+        const double view_range = cell_size;
+
+        if (sqrDst < view_range * view_range && sqrDst > eps) {
+            force += o2_o1 * (1000 / sqrDst);
         }
     }
 
@@ -72,7 +112,7 @@ public:
         double sqrDst = sqrt(o2_b.x * o2_b.x + o2_b.y * o2_b.y);
 
         if (sqrDst <= baseRadius) {
-            obj_1.nextRole = 'C';
+            obj_1.nextRole = Role::Red;
             return;
         }
 
@@ -80,7 +120,7 @@ public:
         sqrDst = sqrt(o2_b.x * o2_b.x + o2_b.y * o2_b.y);
 
         if (sqrDst <= baseRadius) {
-            obj_1.nextRole = 'Z';
+            obj_1.nextRole = Role::Green;
             return;
         }
     }
@@ -0,0 +1,78 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#include "../engine/common/vec.hpp"
+
+// Repulsion of all the static obstacles sampled on a regular lattice, `resolution` points
+// per world unit, both borders included. Agents read it with a bilinear lookup, so the
+// cost no longer depends on the number of obstacles around them. Close to an obstacle
+// the repulsion grows like 1 / distance, the lattice smooths it: a finer resolution
+// follows it closer, at the cost of memory and baking time.
+struct ObstacleField
+{
+	uint32_t            resolution = 0;
+	uint32_t            columns    = 0;
+	uint32_t            rows       = 0;
+	// Force at every lattice point, row major, x and y interleaved.
+	// Single precision keeps the two rows read by a lookup in cache.
+	std::vector<float>  force;
+
+
+	void resize(Vec2 world_size, uint32_t resolution_)
+	{
+		resolution = resolution_;
+		columns    = static_cast<uint32_t>(std::ceil(world_size.x * resolution)) + 1;
+		rows       = static_cast<uint32_t>(std::ceil(world_size.y * resolution)) + 1;
+		force.assign(2 * static_cast<size_t>(columns) * rows, 0.0f);
+	}
+
+	void clear()
+	{
+		resolution = columns = rows = 0;
+		force.clear();
+	}
+
+	[[nodiscard]]
+	bool empty() const
+	{
+		return force.empty();
+	}
+
+	[[nodiscard]]
+	Vec2 getPoint(uint32_t i, uint32_t j) const
+	{
+		return { static_cast<double>(i) / resolution, static_cast<double>(j) / resolution };
+	}
+
+	void set(uint32_t i, uint32_t j, Vec2 value)
+	{
+		float* point = force.data() + 2 * (static_cast<size_t>(j) * columns + i);
+		point[0] = static_cast<float>(value.x);
+		point[1] = static_cast<float>(value.y);
+	}
+
+	// Bilinear interpolation of the four surrounding lattice points, positions outside the
+	// lattice are clamped to its border
+	[[nodiscard]]
+	Vec2 sample(Vec2 position) const
+	{
+		const double u = std::fmin(std::fmax(position.x * resolution, 0.0), static_cast<double>(columns - 1));
+		const double v = std::fmin(std::fmax(position.y * resolution, 0.0), static_cast<double>(rows - 1));
+		const uint32_t i = std::min(static_cast<uint32_t>(u), columns - 2);
+		const uint32_t j = std::min(static_cast<uint32_t>(v), rows - 2);
+		const double   s = u - i;
+		const double   t = v - j;
+
+		const float* p_0 = force.data() + 2 * (static_cast<size_t>(j) * columns + i);
+		const float* p_1 = p_0 + 2 * static_cast<size_t>(columns);
+		const double w_00 = (1.0 - s) * (1.0 - t);
+		const double w_10 = s * (1.0 - t);
+		const double w_01 = (1.0 - s) * t;
+		const double w_11 = s * t;
+		return { p_0[0] * w_00 + p_0[2] * w_10 + p_1[0] * w_01 + p_1[2] * w_11,
+		         p_0[1] * w_00 + p_0[3] * w_10 + p_1[1] * w_01 + p_1[3] * w_11 };
+	}
+};
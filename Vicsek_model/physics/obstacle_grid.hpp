@@ -0,0 +1,103 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+#include "collision_grid.hpp"
+#include "../engine/common/vec.hpp"
+
+// View on the obstacles of one cell, coordinates are contiguous
+struct ObstacleCell
+{
+	const double* x = nullptr;
+	const double* y = nullptr;
+	uint32_t count = 0;
+};
+
+// Static obstacles, kept out of the objects so they cost nothing in the per frame grid
+// update and integration. Built once (when obstacles were added) with a counting sort
+// over the CollisionGrid layout: a cell id addresses the same cell in both grids and the
+// halo cells alias the opposite border the same way.
+// Obstacles outside the world are kept for rendering but never seen by the agents.
+struct ObstacleGrid
+{
+	// Insertion order, rendering and rebuilds read them
+	std::vector<Vec2>     positions;
+
+	std::vector<uint32_t> cell_start;
+	std::vector<uint32_t> cell_count;
+	// Coordinates sorted by cell
+	std::vector<double>   x;
+	std::vector<double>   y;
+
+	uint32_t              column_stride = 0;
+	bool                  dirty         = false;
+
+
+	void add(Vec2 position)
+	{
+		positions.push_back(position);
+		dirty = true;
+	}
+
+	[[nodiscard]]
+	uint32_t size() const
+	{
+		return static_cast<uint32_t>(positions.size());
+	}
+
+	// cell_ids holds the cell of every obstacle (invalid_cell outside the grid), in insertion order
+	void build(const CollisionGrid& grid, const std::vector<uint32_t>& cell_ids)
+	{
+		const uint32_t cells = grid.getCellCount();
+		column_stride = static_cast<uint32_t>(grid.height + 2);
+		cell_start.assign(cells, 0);
+		cell_count.assign(cells, 0);
+
+		for (const uint32_t cell_id : cell_ids) {
+			if (cell_id != CollisionGrid::invalid_cell) {
+				++cell_count[cell_id];
+			}
+		}
+		uint32_t offset = 0;
+		for (uint32_t i{ 0 }; i < cells; ++i) {
+			cell_start[i] = offset;
+			offset += cell_count[i];
+		}
+
+		x.resize(offset);
+		y.resize(offset);
+		std::vector<uint32_t> cursor = cell_start;
+		for (uint32_t i{ 0 }; i < size(); ++i) {
+			if (cell_ids[i] != CollisionGrid::invalid_cell) {
+				const uint32_t slot = cursor[cell_ids[i]]++;
+				x[slot] = positions[i].x;
+				y[slot] = positions[i].y;
+			}
+		}
+
+		grid.forEachHaloCell([this](uint32_t destination, uint32_t source) {
+			cell_start[destination] = cell_start[source];
+			cell_count[destination] = cell_count[source];
+		});
+		dirty = false;
+	}
+
+	[[nodiscard]]
+	ObstacleCell getCell(uint32_t cell_id) const
+	{
+		return { x.data() + cell_start[cell_id], y.data() + cell_start[cell_id], cell_count[cell_id] };
+	}
+
+	// Same addressing as CollisionGrid::getNeighbourCell, from the cell id of the dynamic grid
+	[[nodiscard]]
+	ObstacleCell getNeighbourCell(uint32_t cell_id, int32_t dx, int32_t dy) const
+	{
+		return getCell(cell_id + dx * column_stride + dy);
+	}
+
+	[[nodiscard]]
+	bool empty() const
+	{
+		return x.empty();
+	}
+};
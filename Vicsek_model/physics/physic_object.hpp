@@ -3,8 +3,10 @@
 #include <math.h>  
 
 #include "collision_grid.hpp"
+#include "roles.hpp"
 #include "../engine/common/utils.hpp"
 #include "../engine/common/math.hpp"
+#include "../engine/common/number_generator.hpp"
 
 
 struct PhysicObject
@@ -12,28 +14,25 @@ struct PhysicObject
     Vec2 position = { 0.0, 0.0 };
     Vec2 velocity = { 0.0, 0.0 };
     Vec2 nextVelocity = { 0.0, 0.0 };
-    char nextRole = 'S';
-    char role = 'S';
+    Role nextRole = Role::Searching;
+    Role role = Role::Searching;
     double annealingTime = 10.0;
 
 
     double velocity_module = 50.0;
     double noise_module = 10.0;
 
-    sf::Color color;
 
-
-    uint32_t actual_grid_id;
+    uint32_t actual_grid_id = CollisionGrid::invalid_cell;
 
 
     PhysicObject() = default;
 
     explicit
-        PhysicObject(Vec2 position_, char role_)
+        PhysicObject(Vec2 position_, Role role_)
         : position(position_),
         nextRole(role_)
     {
-        color = sf::Color(0, 0, 0, 255);
     }
 
     void setPosition(Vec2 pos)
@@ -41,15 +40,16 @@ struct PhysicObject
         position = pos;
     }
 
-    void update(double dt)
+    // rng is the object stream for the current step
+    void update(double dt, CounterRNG rng)
     {
-        if (role != 'O') {
+        if (!getTraits(role).is_static) {
 
             
             if (annealingTime < 0)
-                nextRole = 'S';
+                nextRole = Role::Searching;
 
-            if (role != 'S')
+            if (role != Role::Searching)
                 annealingTime -= 0.001;
             
 
@@ -58,8 +58,8 @@ struct PhysicObject
             velocity = normalizeVector(velocity, velocity_module);
 
             Vec2 noiseVector = { 0.0 , 0.0 };
-            noiseVector.x = ((double)rand() / RAND_MAX) - 0.5;
-            noiseVector.y = ((double)rand() / RAND_MAX) - 0.5;
+            noiseVector.x = rng.get() - 0.5;
+            noiseVector.y = rng.get() - 0.5;
 
             velocity += normalizeVector(noiseVector, noise_module);
 
@@ -122,37 +122,13 @@ struct PhysicObject
         position += v;
     }
 
-    sf::Color getColor() {
-        const Vec2 last_update_move = velocity;
-        const double velocity2 = last_update_move.x * last_update_move.x + last_update_move.y * last_update_move.y;
-        //const double color_value = (atan(velocity2) * 2 / 3.1416) * 255;
-        //color = sf::Color(color_value, 255 - color_value, 255 - color_value, 255);
-
-        return color;
-    }
-
-    void roleChange(char newRole) {
+    void roleChange(Role newRole) {
         annealingTime = 1.0;
 
-        if (newRole == 'C') {
-            role = 'C';
-            color = sf::Color(255, 0, 0, 255);
+        role = newRole;
+        if (!getTraits(newRole).is_static) {
             velocity = -velocity;
         }
-        else if (newRole == 'Z') {
-            role = 'Z';
-            color = sf::Color(0, 255, 0, 255);
-            velocity = -velocity;
-        }
-        else if (newRole == 'S') {
-            role = 'S';
-            color = sf::Color(0, 0, 0, 255);
-            velocity = -velocity;
-        }
-        else if (newRole == 'O') {
-            role = 'O';
-            color = sf::Color(255, 255, 255, 255);
-        }
     }
 };
 
@@ -1,143 +1,409 @@
 #pragma once
 #include "collision_grid.hpp"
+#include "obstacle_grid.hpp"
+#include "obstacle_field.hpp"
 #include "physic_object.hpp"
+#include "agent_store.hpp"
 #include "environment.hpp"
+#include "contact_kernel.hpp"
 
 #include "../engine/common/utils.hpp"
 #include "../engine/common/index_vector.hpp"
 #include "../thread_pool/thread_pool.hpp"
+#include "../thread_pool/task_graph.hpp"
 #include "../engine/common/time_analyzer.hpp"
+#include "../engine/common/profiler.hpp"
 #include "../engine/common/math.hpp"
 
-#include <SFML/System/Vector2.hpp>
-
 struct PhysicSolver
 {
     CIVector<PhysicObject> objects;
+    AgentStore             agents;
     CollisionGrid          grid;
+    ObstacleGrid           obstacles;
+    ObstacleField          obstacle_field;
     Vec2                   world_size;
 
+    // Random streams are keyed by object ID and step, so a run only depends on its seed
+    static constexpr uint64_t scenario_stream = ~0ull;
+    // Upper bound of the values an object draws in one step
+    static constexpr uint64_t random_per_step = 4;
+    uint64_t               seed       = 1;
+    uint64_t               step_count = 0;
+
     // Simulation solving pass count
     tp::ThreadPool& thread_pool;
 
+    // Number of slots of each grid bucket, then their first slot
+    std::vector<uint32_t> grid_bucket_slots;
+    // Cell of every object, written by the integration so the grid update does not read the
+    // objects again. Recomputed when objects were added or removed since.
+    tp::FirstTouchVector<uint32_t> cell_keys;
+    bool                  cell_keys_valid    = false;
+    uint64_t              cell_keys_op_count = 0;
+
+    // Incremental mode: after a full build with slack, only the objects that changed cell
+    // are moved. The grid is rebuilt when objects are added or removed or a cell overflows.
+    // The cells slack starts small and doubles after each overflow, up to the maximum.
+    // It only pays off when few objects change cell per step: cells much larger than the
+    // distance an agent covers in a step. With a fifth of the objects moving the full build is faster.
+    bool                  incremental_grid = false;
+    bool                  grid_valid       = false;
+    uint64_t              grid_op_count    = 0;
+    uint32_t              grid_slack_slots = 4;
+    static constexpr uint32_t max_slack_slots = 64;
+    // Objects that changed cell, in index order, found by one slice and sorted by the grid
+    // bucket of their old cell (removals) and of their new cell (additions)
+    struct GridMoves
+    {
+        std::vector<uint32_t>                      removed;
+        std::vector<std::pair<uint32_t, uint32_t>> added;
+    };
+    // Moves of slice s and bucket b at s * bucket_count + b
+    std::vector<GridMoves> grid_moves;
+    // Buckets where a cell overflowed during the last incremental update
+    std::vector<uint8_t>   grid_bucket_overflow;
+
+    // Objects are sorted by cell every `reorder_period` steps so the neighbours of a cell
+    // are contiguous in memory, 0 disables it
+    uint32_t              reorder_period = 0;
+    std::vector<uint32_t> reorder_map;
+
+    // Obstacles baked into a repulsion field with this many samples per world unit, the agents
+    // near obstacles read it instead of evaluating every obstacle. 0 disables it.
+    uint32_t              obstacle_field_resolution = 0;
+    // Field rows per baking chunk, a row costs a few thousand object updates
+    static constexpr uint32_t obstacle_field_grain = 4;
+
+    // Half stencil mode: each pair is evaluated once and both agents are updated
+    bool                  symmetric_contacts = false;
+    // Half stencil mode: contributions of the pairs evaluated from the column on the left,
+    // added to nextVelocity by the integration. Kept apart so the summation order does not
+    // depend on which of the two columns was solved first, that is on the slabs layout.
+    tp::FirstTouchVector<Vec2> west_velocity;
+
+    // Neighbour search slabs per thread, more slabs than threads let idle workers steal
+    uint32_t              slabs_per_thread = 8;
+    // Empty cells checked for the cost of one object when balancing the slabs
+    static constexpr uint32_t cells_per_object = 16;
+    // Column bounds of the neighbour search slabs
+    std::vector<uint32_t> slab_bounds;
+
+    // Neighbours of the cell being processed split by role, in neighbour order
+    struct RoleBuckets
+    {
+        std::vector<uint32_t> ids[role_count];
+        // Symmetric mode: ids holds the objects of the cell then of the S cell, east_ids the E, SE and NE ones
+        std::vector<uint32_t> east_ids[role_count];
+    };
+    // One set per slab, a slab is processed by a single thread
+    std::vector<RoleBuckets> role_buckets;
+
+    // Neighbour search and integration run as one task graph instead of two phases, see
+    // solveAndIntegrate. The grid update stays a global phase before the graph. A slab
+    // integrates the objects of its columns, only contiguous when they are sorted by cell:
+    // without reorder_period every slab reloads the whole object arrays and the phased
+    // update is faster, the headless and benchmark tools reject it.
+    bool                  pipelined_update = false;
+    tp::TaskGraph         step_graph;
+    // Slab count the graph was built for
+    uint32_t              step_graph_slabs = 0;
+    // Objects of each slab in index order, slab i at [slab_object_start[i], slab_object_start[i + 1])
+    // of slab_objects and the objects outside the grid last. Built by the step graph.
+    tp::FirstTouchVector<uint32_t> slab_objects;
+    std::vector<uint32_t>          slab_object_start;
+    // Objects of every slice per list, then the slice write cursors
+    std::vector<uint32_t>          slab_slice_counts;
+    std::vector<uint32_t>          column_slab;
+
     PhysicSolver(IVec2 size, uint32_t cell_size, tp::ThreadPool& tp)
         : grid{ size.x, size.y, cell_size }
         , world_size{ to<double>(size.x), to<double>(size.y) }
         , thread_pool{ tp }
     {
-        grid.clear();
+        grid.setSliceCount(tp.m_thread_count);
+        grid_bucket_slots.resize(grid.bucket_count);
+        grid_bucket_overflow.resize(grid.bucket_count);
+        grid_moves.resize(static_cast<size_t>(grid.slice_count) * grid.bucket_count);
     }
 
+    // Bounds of the ith slice when splitting `count` elements in `slice_count` slices
+    static uint32_t getSliceBound(uint32_t i, uint32_t count, uint32_t slice_count)
+    {
+        return to<uint32_t>((static_cast<uint64_t>(count) * i) / slice_count);
+    }
 
-    // Checks if two atoms are colliding and if so create a new contact
-    void solveContact(uint32_t atom_1_idx, uint32_t atom_2_idx)
+    // Calls callback(slice, start, end) for every object slice of the grid passes. A slice is
+    // one dispatch chunk, so with pinned workers each node starts with the slices of its own objects.
+    template<typename TCallback>
+    void dispatchSlices(TCallback&& callback)
     {
-        constexpr double eps = 0.0001;
+        const uint32_t object_count = to<uint32_t>(objects.size());
+        const uint32_t slice_count  = grid.slice_count;
+        thread_pool.dispatch(slice_count, [&callback, object_count, slice_count](uint32_t first, uint32_t last) {
+            for (uint32_t i{ first }; i < last; ++i) {
+                callback(i, getSliceBound(i, object_count, slice_count), getSliceBound(i + 1, object_count, slice_count));
+            }
+        }, 1);
+    }
 
-        PhysicObject& obj_1 = objects.data[atom_1_idx];
-        PhysicObject& obj_2 = objects.data[atom_2_idx];
 
-        Environment::getInstance().solveContact(obj_1, obj_2, grid.cell_size);
+    // Runs the kernel of every role the agent interacts with over the matching bucket
+    void checkBoidsCellDetection(uint32_t atom_idx, const RoleBuckets& buckets, Vec2& next_velocity)
+    {
+        const Role role = agents.role[atom_idx];
+        const uint32_t mask = getInteractionMask(role);
+        for (uint32_t i{ 0 }; i < role_count; ++i) {
+            const std::vector<uint32_t>& ids = buckets.ids[i];
+            if (((mask >> i) & 1u) && !ids.empty()) {
+                ContactKernel::solve(role, getRole(i), agents, atom_idx, ids.data(), to<uint32_t>(ids.size()), next_velocity, grid.cell_size);
+            }
+        }
     }
 
+    // Non empty obstacle cells around a cell, in the processCell neighbours order. Returns their count.
+    uint32_t getObstacleCells(uint32_t cell_x, uint32_t cell_y, ObstacleCell (&cells)[9]) const
+    {
+        if (obstacles.empty()) {
+            return 0;
+        }
+        constexpr int32_t offsets[9][2] = { { 0, -1 }, { 0, 0 }, { 0, 1 }, { 1, -1 }, { 1, 0 }, { 1, 1 }, { -1, -1 }, { -1, 0 }, { -1, 1 } };
+        const uint32_t cell_id = grid.getCellIndex(cell_x, cell_y);
+        uint32_t count = 0;
+        for (const auto& offset : offsets) {
+            const ObstacleCell cell = obstacles.getNeighbourCell(cell_id, offset[0], offset[1]);
+            if (cell.count) {
+                cells[count++] = cell;
+            }
+        }
+        return count;
+    }
 
-    void checkBoidsCellDetection(uint32_t atom_idx, const CollisionCell& c)
+    // With the field the obstacles cells only tell whether the agent can be influenced
+    void checkObstacles(uint32_t atom_idx, const ObstacleCell* cells, uint32_t count, Vec2& next_velocity)
     {
-        for (const auto& element_id : c.objects) {
-            solveContact(atom_idx, element_id);
+        if (count && obstacle_field_resolution) {
+            if (getInteraction(agents.role[atom_idx], Role::Obstacle) == Interaction::Repulsion) {
+                next_velocity += obstacle_field.sample({ agents.x[atom_idx], agents.y[atom_idx] });
+            }
+            return;
+        }
+        for (uint32_t i{ 0 }; i < count; ++i) {
+            ContactKernel::solveObstacles(agents, atom_idx, cells[i].x, cells[i].y, cells[i].count, next_velocity, grid.cell_size);
         }
     }
 
-    void processCell(const CollisionCell& c, uint32_t index)
+    // Neighbour cells are resolved once per cell through the grid halo and their objects
+    // are bucketed by role, only the roles the agents of the cell interact with are kept.
+    // Only the agents of the cell are written, neighbours are read from the agents store.
+    void processCell(uint32_t cell_x, uint32_t cell_y, RoleBuckets& buckets)
     {
-        for (const auto& element_id : c.objects) {
-            const uint32_t atom_idx = element_id;
-            const uint32_t grid_size = grid.height * grid.width;
+        const CollisionCell c = grid.getNeighbourCell(cell_x, cell_y, 0, 0);
+        if (!c.objects_count) {
+            return;
+        }
 
-            const uint32_t cell_x_pos = index / grid.height;
-            const uint32_t cell_y_pos = index % grid.height;
+        const CollisionCell neighbours[] = {
+            grid.getNeighbourCell(cell_x, cell_y,  0, -1),  // N
+            c,                                              // C
+            grid.getNeighbourCell(cell_x, cell_y,  0,  1),  // S
+            grid.getNeighbourCell(cell_x, cell_y,  1, -1),  // NE
+            grid.getNeighbourCell(cell_x, cell_y,  1,  0),  // E
+            grid.getNeighbourCell(cell_x, cell_y,  1,  1),  // SE
+            grid.getNeighbourCell(cell_x, cell_y, -1, -1),  // NW
+            grid.getNeighbourCell(cell_x, cell_y, -1,  0),  // W
+            grid.getNeighbourCell(cell_x, cell_y, -1,  1),  // SW
+        };
+        ObstacleCell obstacle_cells[9];
+        const uint32_t obstacle_count = getObstacleCells(cell_x, cell_y, obstacle_cells);
+
+        uint32_t mask = 0;
+        for (const uint32_t atom_idx : c) {
+            mask |= getInteractionMask(agents.role[atom_idx]);
+        }
+        for (auto& ids : buckets.ids) {
+            ids.clear();
+        }
+        if (mask) {
+            for (const CollisionCell& neighbour : neighbours) {
+                for (const uint32_t atom_idx : neighbour) {
+                    const uint32_t role = getRoleIndex(agents.role[atom_idx]);
+                    if ((mask >> role) & 1u) {
+                        buckets.ids[role].push_back(atom_idx);
+                    }
+                }
+            }
+        }
 
-            uint32_t N  = index - 1;
-            uint32_t C  = index;
-            uint32_t S  = index + 1;
+        for (const uint32_t atom_idx : c) {
+            // Accumulated locally and written back once per agent
+            Vec2 next_velocity = objects.data[atom_idx].nextVelocity;
+            checkBoidsCellDetection(atom_idx, buckets, next_velocity);
+            checkObstacles(atom_idx, obstacle_cells, obstacle_count, next_velocity);
+            objects.data[atom_idx].nextVelocity = next_velocity;
+        }
+    }
 
-            uint32_t NE = index + grid.height - 1;
-            uint32_t E  = index + grid.height;
-            uint32_t SE = index + grid.height + 1;
+    // Visits the pairs inside the cell once, then the S, E, SE and NE cells, which covers each
+    // neighbour pair once. The agents of the next column only receive contributions in
+    // west_velocity, written by this column alone, so slabs run in a single pass.
+    // As in processCell the objects are bucketed by role, keeping the roles the agents of the
+    // cell interact with one way or the other. An agent's pairs inside the cell are the
+    // objects after it in its cell's part of each bucket.
+    void processCellSymmetric(uint32_t cell_x, uint32_t cell_y, RoleBuckets& buckets)
+    {
+        const CollisionCell c = grid.getNeighbourCell(cell_x, cell_y, 0, 0);
+        if (!c.objects_count) {
+            return;
+        }
+
+        const CollisionCell south = grid.getNeighbourCell(cell_x, cell_y, 0, 1);
+        const CollisionCell east_neighbours[] = {
+            grid.getNeighbourCell(cell_x, cell_y, 1,  0),  // E
+            grid.getNeighbourCell(cell_x, cell_y, 1,  1),  // SE
+            grid.getNeighbourCell(cell_x, cell_y, 1, -1),  // NE
+        };
 
-            uint32_t NW = index - grid.height - 1;
-            uint32_t W  = index - grid.height;
-            uint32_t SW = index - grid.height + 1;
+        ObstacleCell obstacle_cells[9];
+        const uint32_t obstacle_count = getObstacleCells(cell_x, cell_y, obstacle_cells);
 
-            if (cell_y_pos == 0) {
-                N  += grid.height;
-                NE += grid.height;
-                NW += grid.height;
+        uint32_t mask = 0;
+        for (const uint32_t atom_idx : c) {
+            mask |= getMutualInteractionMask(agents.role[atom_idx]);
+        }
+        for (uint32_t i{ 0 }; i < role_count; ++i) {
+            buckets.ids[i].clear();
+            buckets.east_ids[i].clear();
+        }
+        const auto addToBuckets = [this, mask](const CollisionCell& cell, std::vector<uint32_t> (&ids)[role_count]) {
+            for (const uint32_t atom_idx : cell) {
+                const uint32_t role = getRoleIndex(agents.role[atom_idx]);
+                if ((mask >> role) & 1u) {
+                    ids[role].push_back(atom_idx);
+                }
             }
-            else if (cell_y_pos == grid.height - 1) {
-                S  -= grid.height;
-                SE -= grid.height;
-                SW -= grid.height;
+        };
+        if (mask) {
+            addToBuckets(c, buckets.ids);
+            addToBuckets(south, buckets.ids);
+            for (const CollisionCell& neighbour : east_neighbours) {
+                addToBuckets(neighbour, buckets.east_ids);
             }
+        }
 
-            if (cell_x_pos == 0) {
-                NW += grid_size;
-                W  += grid_size;
-                SW += grid_size;
+        const auto next_velocity_of = [this](uint32_t atom) -> Vec2& {
+            return objects.data[atom].nextVelocity;
+        };
+        const auto west_velocity_of = [this](uint32_t atom) -> Vec2& {
+            return west_velocity[atom];
+        };
+        const double cell_size = grid.cell_size;
+        // Objects of each bucket already visited in the cell, the agent itself included
+        uint32_t visited[role_count] = {};
+        for (const uint32_t atom_idx : c) {
+            const Role role = agents.role[atom_idx];
+            const uint32_t role_index = getRoleIndex(role);
+            if ((mask >> role_index) & 1u) {
+                ++visited[role_index];
             }
-            else if (cell_x_pos == grid.width - 1) {
-                NE -= grid_size;
-                E  -= grid_size;
-                SE -= grid_size;
+            // The agent's own accumulator is only written by its own pairs while it is processed
+            Vec2 next_velocity = objects.data[atom_idx].nextVelocity;
+            const uint32_t atom_mask = getMutualInteractionMask(role);
+            for (uint32_t i{ 0 }; i < role_count; ++i) {
+                if (!((atom_mask >> i) & 1u)) {
+                    continue;
+                }
+                const std::vector<uint32_t>& ids = buckets.ids[i];
+                if (ids.size() > visited[i]) {
+                    ContactKernel::solveSymmetric(role, getRole(i), agents, atom_idx, ids.data() + visited[i], to<uint32_t>(ids.size()) - visited[i], next_velocity, cell_size, next_velocity_of);
+                }
+                const std::vector<uint32_t>& east_ids = buckets.east_ids[i];
+                if (!east_ids.empty()) {
+                    ContactKernel::solveSymmetric(role, getRole(i), agents, atom_idx, east_ids.data(), to<uint32_t>(east_ids.size()), next_velocity, cell_size, west_velocity_of);
+                }
             }
+            // Obstacles are static, only the agent side is updated
+            checkObstacles(atom_idx, obstacle_cells, obstacle_count, next_velocity);
+            objects.data[atom_idx].nextVelocity = next_velocity;
+        }
+    }
 
-            checkBoidsCellDetection(atom_idx, grid.data[N]);
-            checkBoidsCellDetection(atom_idx, grid.data[C]);
-            checkBoidsCellDetection(atom_idx, grid.data[S]);
-            checkBoidsCellDetection(atom_idx, grid.data[NE]);
-            checkBoidsCellDetection(atom_idx, grid.data[E]);
-            checkBoidsCellDetection(atom_idx, grid.data[SE]);
-            checkBoidsCellDetection(atom_idx, grid.data[NW]);
-            checkBoidsCellDetection(atom_idx, grid.data[W]);
-            checkBoidsCellDetection(atom_idx, grid.data[SW]);
+    // Splits the grid columns in non empty slabs holding about the same work, estimated
+    // from the objects per column (read from the cell starts) plus the cells
+    void computeSlabBounds(uint32_t slab_count)
+    {
+        const uint32_t width = to<uint32_t>(grid.width);
+        slab_count = std::max(1u, std::min(slab_count, width));
+
+        const uint32_t column_cost = std::max(1u, to<uint32_t>(grid.height) / cells_per_object);
+        const auto getWork = [this, column_cost](uint32_t x) {
+            return static_cast<uint64_t>(grid.getColumnStart(x)) + static_cast<uint64_t>(x) * column_cost;
+        };
+        const uint64_t total_work = getWork(width);
+
+        slab_bounds.resize(slab_count + 1);
+        slab_bounds[0] = 0;
+        for (uint32_t i{ 1 }; i < slab_count; ++i) {
+            const uint64_t target = (total_work * i) / slab_count;
+            // At least one column per slab, and enough columns left for the next ones
+            uint32_t x = slab_bounds[i - 1] + 1;
+            while (x < width - (slab_count - i) && getWork(x) < target) {
+                ++x;
+            }
+            slab_bounds[i] = x;
         }
+        slab_bounds[slab_count] = width;
     }
 
-    void solveCollisionThreaded(uint32_t i, uint32_t slice_size)
+    // Sweeps the columns of slab i, each column cell by cell in memory order
+    void solveCollisionThreaded(uint32_t i)
     {
-        const uint32_t start = i * slice_size;
-        const uint32_t end = (i + 1) * slice_size;
-        for (uint32_t idx{ start }; idx < end; ++idx) {
-            processCell(grid.data[idx], idx);
+        RoleBuckets& buckets = role_buckets[i];
+        ProfileScope scope{ "neighbours_slice", i };
+        const uint32_t start = slab_bounds[i];
+        const uint32_t end = slab_bounds[i + 1];
+        const uint32_t height = grid.height;
+        for (uint32_t x{ start }; x < end; ++x) {
+            if (symmetric_contacts) {
+                for (uint32_t y{ 0 }; y < height; ++y) {
+                    processCellSymmetric(x, y, buckets);
+                }
+            }
+            else {
+                for (uint32_t y{ 0 }; y < height; ++y) {
+                    processCell(x, y, buckets);
+                }
+            }
+        }
+    }
+
+    // Multi-thread grid, slabs balanced by work and covering every column. Returns the slab count.
+    uint32_t prepareSlabs()
+    {
+        computeSlabBounds(slabs_per_thread * thread_pool.m_thread_count);
+        const uint32_t slab_count = to<uint32_t>(slab_bounds.size()) - 1;
+        if (role_buckets.size() < slab_count) {
+            role_buckets.resize(slab_count);
         }
+        return slab_count;
     }
 
     // Find nearby boids
     void solveNeighborhood()
     {
-        clock_t time_req = clock();
-
-        // Multi-thread grid
-        const uint32_t thread_count = thread_pool.m_thread_count;
-        const uint32_t slice_count = thread_count * 2;
-        const uint32_t slice_size = (grid.width / slice_count) * grid.height;
-        // Find collisions in two passes to avoid data races
-        // First collision pass
-        for (uint32_t i{ 0 }; i < thread_count; ++i) {
-            thread_pool.addTask([this, i, slice_size] {
-                solveCollisionThreaded(2 * i, slice_size);
-                });
-        }
-        thread_pool.waitForCompletion();
-        // Second collision pass
-        for (uint32_t i{ 0 }; i < thread_count; ++i) {
-            thread_pool.addTask([this, i, slice_size] {
-                solveCollisionThreaded(2 * i + 1, slice_size);
-                });
-        }
-        thread_pool.waitForCompletion();
+        ProfileScope scope{ "neighbours" };
+        const uint32_t slab_count = prepareSlabs();
+        // One slab per dispatch chunk: idle threads pull the next slab, and with pinned
+        // workers each node starts with the slabs of its own columns. A slab only writes
+        // the accumulators of its own agents (and west_velocity of the next column in
+        // symmetric mode), so all slabs run in a single pass without barrier.
+        thread_pool.dispatch(slab_count, [this](uint32_t start, uint32_t end) {
+            for (uint32_t i{ start }; i < end; ++i) {
+                solveCollisionThreaded(i);
+            }
+        }, 1);
 
-        TimeAnalyzer::getInstance().collision_time = clock() - time_req;
+        TimeAnalyzer::getInstance().collision_time = to<float>(scope.getElapsedMs());
     }
 
     // Add a new object to the solver
@@ -147,68 +413,594 @@ struct PhysicSolver
     }
 
     // Add a new object to the solver
-    uint64_t createObject(Vec2 pos, char role)
+    uint64_t createObject(Vec2 pos, Role role)
     {
         return objects.emplace_back(pos, role);
     }
 
+    // Static obstacle, the obstacles grid is rebuilt on the next grid update
+    void createObstacle(Vec2 pos)
+    {
+        obstacles.add(pos);
+    }
+
     void update(float dt)
     {    
         addObjectsToGrid();          
-        solveNeighborhood();
-        updateObjects_multi(dt);
+        if (pipelined_update) {
+            solveAndIntegrate(dt);
+        }
+        else {
+            solveNeighborhood();
+            updateObjects_multi(dt);
+        }
     }
 
     void addObjectsToGrid()
     {
-        clock_t time_req = clock();
-        //grid.clear();
-        
-        for (const PhysicObject& obj : objects.data) {
-            obj;
-            grid.clear(obj.actual_grid_id);
+        ProfileScope scope{ "grid" };
+        if (obstacles.dirty) {
+            buildObstacles();
+        }
+        if (obstacle_field.resolution != obstacle_field_resolution) {
+            bakeObstacleField();
+        }
+        updateCellKeys();
+        const bool incremental = incremental_grid && grid_valid && grid_op_count == objects.op_count;
+        if (!incremental || !updateGridIncremental()) {
+            buildGrid();
         }
-        
-        TimeAnalyzer::getInstance().clear_grid_time = clock() - time_req;
 
-        time_req = clock();
-        // Safety border to avoid adding object outside the grid
-        uint32_t i{ 0 };
-        for (PhysicObject& obj : objects.data) {
-            if (obj.position.x > 0.0 && obj.position.x < world_size.x &&
-                obj.position.y > 0.0 && obj.position.y < world_size.y) {
-                //grid.addAtom(to<int32_t>(obj.position.x), to<int32_t>(obj.position.y), i);
-                grid.updateAtomCell(to<int32_t>(obj.position.x), to<int32_t>(obj.position.y), i, obj.actual_grid_id);
+        if (reorder_period && step_count % reorder_period == 0) {
+            reorderObjects();
+        }
+
+        TimeAnalyzer::getInstance().update_grid_time = to<float>(scope.getElapsedMs() - TimeAnalyzer::getInstance().clear_grid_time);
+    }
+
+    void buildObstacles()
+    {
+        ProfileScope scope{ "obstacles_build" };
+        std::vector<uint32_t> cell_ids(obstacles.size());
+        for (uint32_t i{ 0 }; i < obstacles.size(); ++i) {
+            cell_ids[i] = getPositionCell(obstacles.positions[i]);
+        }
+        obstacles.build(grid, cell_ids);
+        obstacle_field.clear();
+    }
+
+    // Samples the obstacles repulsion on the field lattice, each point sees the obstacles
+    // of the nine cells around it like an agent would
+    void bakeObstacleField()
+    {
+        ProfileScope scope{ "obstacles_bake" };
+        if (!obstacle_field_resolution) {
+            obstacle_field.clear();
+            return;
+        }
+        obstacle_field.resize(world_size, obstacle_field_resolution);
+        if (obstacles.empty()) {
+            return;
+        }
+        thread_pool.dispatch(obstacle_field.rows, [&](uint32_t start, uint32_t end) {
+            Environment& environment = Environment::getInstance();
+            for (uint32_t j{ start }; j < end; ++j) {
+                for (uint32_t i{ 0 }; i < obstacle_field.columns; ++i) {
+                    const Vec2 point = obstacle_field.getPoint(i, j);
+                    const uint32_t cell_x = std::min(to<uint32_t>(point.x) / grid.cell_size, to<uint32_t>(grid.width - 1));
+                    const uint32_t cell_y = std::min(to<uint32_t>(point.y) / grid.cell_size, to<uint32_t>(grid.height - 1));
+                    const uint32_t cell_id = grid.getCellIndex(cell_x, cell_y);
+                    Vec2 force = { 0.0, 0.0 };
+                    for (int32_t dx{ -1 }; dx <= 1; ++dx) {
+                        for (int32_t dy{ -1 }; dy <= 1; ++dy) {
+                            const ObstacleCell cell = obstacles.getNeighbourCell(cell_id, dx, dy);
+                            for (uint32_t k{ 0 }; k < cell.count; ++k) {
+                                environment.addObstacleRepulsion(point, cell.x[k], cell.y[k], force, grid.cell_size);
+                            }
+                        }
+                    }
+                    obstacle_field.set(i, j, force);
+                }
+            }
+        }, obstacle_field_grain);
+    }
+
+    // Value initialises the elements grown past the current size. When the storage has to be
+    // reallocated the kept elements are copied by the same chunks, so every page is first
+    // touched by the node that processes the same range in dispatch, when the workers are pinned.
+    template<typename T>
+    void growFirstTouch(tp::FirstTouchVector<T>& vector, uint32_t size)
+    {
+        const uint32_t old_size = to<uint32_t>(vector.size());
+        if (size <= old_size) {
+            return;
+        }
+        // Grown elements are not written by resize, see tp::FirstTouchAllocator
+        const bool reallocate = size > vector.capacity();
+        tp::FirstTouchVector<T> grown;
+        if (reallocate) {
+            grown.resize(size);
+        }
+        else {
+            vector.resize(size);
+        }
+        T* destination = reallocate ? grown.data() : vector.data();
+        const T* source = vector.data();
+        thread_pool.firstTouch(size, [destination, source, old_size, reallocate](uint32_t start, uint32_t end) {
+            if (reallocate && start < old_size) {
+                std::copy(source + start, source + std::min(end, old_size), destination + start);
+            }
+            std::fill(destination + std::max(start, old_size), destination + std::max(end, old_size), T{});
+        });
+        if (reallocate) {
+            vector.swap(grown);
+        }
+    }
+
+    // The objects are created by the thread building the scenario. With the workers pinned on
+    // several nodes, once their count changed they are moved to fresh storage whose pages are
+    // first touched by firstTouch chunks, like the other per object arrays, before the objects
+    // are copied in. Otherwise the storage is left alone.
+    void placeObjects()
+    {
+        if (thread_pool.m_node_count < 2) {
+            return;
+        }
+        auto& data = objects.data;
+        const uint32_t slot_count = to<uint32_t>(data.size());
+        std::vector<PhysicObject> placed;
+        placed.reserve(slot_count);
+        // Reserved but not yet constructed, only the pages are touched here
+        unsigned char* storage = reinterpret_cast<unsigned char*>(placed.data());
+        thread_pool.firstTouch(slot_count, [storage](uint32_t start, uint32_t end) {
+            std::fill(storage + sizeof(PhysicObject) * start, storage + sizeof(PhysicObject) * end, static_cast<unsigned char>(0));
+        });
+        placed.assign(data.begin(), data.end());
+        data.swap(placed);
+    }
+
+    // Per object arrays of the integration. The agents store is refreshed from the objects
+    // after a resize (see updateCellKeys), so its values are not kept.
+    void resizeObjectArrays(uint32_t object_count)
+    {
+        const uint32_t old_count = agents.size();
+        if (object_count != old_count) {
+            placeObjects();
+            agents.resize(object_count);
+            thread_pool.firstTouch(object_count, [this](uint32_t start, uint32_t end) {
+                for (uint32_t i{ start }; i < end; ++i) {
+                    agents.reset(i);
+                }
+            });
+        }
+        if (cell_keys.size() > object_count) {
+            cell_keys.resize(object_count);
+        }
+        growFirstTouch(cell_keys, object_count);
+        if (symmetric_contacts) {
+            // Always zero between steps, the integration consumes it
+            if (west_velocity.size() > object_count) {
+                west_velocity.resize(object_count);
             }
-            ++i;
+            growFirstTouch(west_velocity, object_count);
         }
-        TimeAnalyzer::getInstance().update_grid_time = clock() - time_req;
     }
 
+    // Only grows, so the steady state does not allocate
+    void reserveGridObjects(uint32_t object_count)
+    {
+        growFirstTouch(grid.object_slot, object_count);
+        growFirstTouch(grid.object_cell, object_count);
+        growFirstTouch(grid.binned_objects, object_count);
+        growFirstTouch(grid.binned_cells, object_count);
+    }
 
-    void updateObjects_multi(float dt)
+    // Slots are ordered by column, so a node mostly owns the slots of the columns it solves
+    // (see solveNeighborhood)
+    void reserveGridSlots(uint32_t slot_count)
     {
-        thread_pool.dispatch(to<uint32_t>(objects.size()), [&](uint32_t start, uint32_t end) {
+        growFirstTouch(grid.objects, slot_count);
+    }
+
+    // Refreshes the agents store and the cell keys when the integration did not
+    void updateCellKeys()
+    {
+        const uint32_t object_count = to<uint32_t>(objects.size());
+        if (cell_keys_valid && cell_keys_op_count == objects.op_count && cell_keys.size() == object_count) {
+            return;
+        }
+        ProfileScope scope{ "cell_keys" };
+        resizeObjectArrays(object_count);
+        thread_pool.dispatch(object_count, [&](uint32_t start, uint32_t end) {
             for (uint32_t i{ start }; i < end; ++i) {
                 PhysicObject& obj = objects.data[i];
+                agents.store(i, obj);
+                obj.actual_grid_id = cell_keys[i] = getObjectCell(obj);
+            }
+        });
+        cell_keys_valid    = true;
+        cell_keys_op_count = objects.op_count;
+    }
+
+    // Full rebuild with a counting sort by bucket then by cell, see CollisionGrid
+    void buildGrid()
+    {
+        ProfileScope scope{ "grid_build" };
+        reserveGridObjects(to<uint32_t>(objects.size()));
 
-                Environment::getInstance().reachingTheBaseDetection(obj);
-                obj.update(dt);
+        // First pass: count the buckets occupancy, one histogram per slice
+        dispatchSlices([this](uint32_t slice, uint32_t start, uint32_t end) {
+            countObjectsSlice(slice, start, end);
+        });
 
-                //periodic ownership of the border
-                if (obj.position.x > world_size.x) {
-                    obj.position.x = obj.position.x - (world_size.x);
-                }
-                else if (obj.position.x < 0.0) {
-                    obj.position.x = (obj.position.x) + (world_size.x);
+        TimeAnalyzer::getInstance().clear_grid_time = to<float>(scope.getElapsedMs());
+        grid.slack_slots = incremental_grid ? grid_slack_slots : 0;
+        grid.computeBucketStarts();
+
+        // Second pass: bin object indices by bucket
+        dispatchSlices([this](uint32_t slice, uint32_t start, uint32_t end) {
+            binObjectsSlice(slice, start, end);
+        });
+
+        // Each bucket then only touches its own cells: occupancy, prefix sum over the
+        // buckets totals, and scatter into the cells
+        const uint32_t bucket_count = grid.bucket_count;
+        thread_pool.dispatch(bucket_count, [this](uint32_t start, uint32_t end) {
+            for (uint32_t b{ start }; b < end; ++b) {
+                grid_bucket_slots[b] = grid.countBucket(b);
+            }
+        }, 1);
+        uint32_t offset = 0;
+        for (uint32_t b{ 0 }; b < bucket_count; ++b) {
+            const uint32_t slots = grid_bucket_slots[b];
+            grid_bucket_slots[b] = offset;
+            offset += slots;
+        }
+        reserveGridSlots(offset);
+        thread_pool.dispatch(bucket_count, [this](uint32_t start, uint32_t end) {
+            for (uint32_t b{ start }; b < end; ++b) {
+                ProfileScope bucket_scope{ "grid_bucket", b };
+                grid.fillBucket(b, grid_bucket_slots[b]);
+            }
+        }, 1);
+        grid.updateHalo();
+
+        grid_valid    = true;
+        grid_op_count = objects.op_count;
+    }
+
+    // Moves the objects that changed cell. Each grid bucket applies the moves of its own cells,
+    // all removals first so objects leaving a cell free their slots for the ones coming in.
+    // Inside a cell the moves keep the index order, so the result does not depend on the threads.
+    // Returns false when a cell overflows, the grid then has to be rebuilt.
+    bool updateGridIncremental()
+    {
+        const uint32_t slice_count  = grid.slice_count;
+        const uint32_t bucket_count = grid.bucket_count;
+        ProfileScope scope{ "grid_update" };
+        dispatchSlices([this](uint32_t slice, uint32_t start, uint32_t end) {
+            findMoversSlice(slice, start, end);
+        });
+        TimeAnalyzer::getInstance().clear_grid_time = to<float>(scope.getElapsedMs());
+
+        thread_pool.dispatch(bucket_count, [this, slice_count, bucket_count](uint32_t start, uint32_t end) {
+            for (uint32_t b{ start }; b < end; ++b) {
+                for (uint32_t s{ 0 }; s < slice_count; ++s) {
+                    for (const uint32_t atom : grid_moves[s * bucket_count + b].removed) {
+                        grid.removeAtom(grid.object_cell[atom], atom);
+                    }
                 }
-                if (obj.position.y > world_size.y) {
-                    obj.position.y = obj.position.y - (world_size.y);
+            }
+        }, 1);
+        thread_pool.dispatch(bucket_count, [this, slice_count, bucket_count](uint32_t start, uint32_t end) {
+            for (uint32_t b{ start }; b < end; ++b) {
+                bool fits = true;
+                for (uint32_t s{ 0 }; s < slice_count && fits; ++s) {
+                    for (const auto& [atom, cell_id] : grid_moves[s * bucket_count + b].added) {
+                        if (!grid.addAtom(cell_id, atom)) {
+                            fits = false;
+                            break;
+                        }
+                    }
                 }
-                else if (obj.position.y < 0.0) {
-                    obj.position.y = (obj.position.y) + (world_size.y);
+                grid_bucket_overflow[b] = !fits;
+            }
+        }, 1);
+
+        if (std::find(grid_bucket_overflow.begin(), grid_bucket_overflow.end(), 1) != grid_bucket_overflow.end()) {
+            grid_valid       = false;
+            grid_slack_slots = std::min(2 * grid_slack_slots, max_slack_slots);
+            return false;
+        }
+        grid.updateHalo();
+        return true;
+    }
+
+    void findMoversSlice(uint32_t slice, uint32_t start, uint32_t end)
+    {
+        ProfileScope scope{ "grid_movers_slice", slice };
+        GridMoves* moves = grid_moves.data() + static_cast<size_t>(slice) * grid.bucket_count;
+        for (uint32_t b{ 0 }; b < grid.bucket_count; ++b) {
+            moves[b].removed.clear();
+            moves[b].added.clear();
+        }
+        for (uint32_t i{ start }; i < end; ++i) {
+            const uint32_t old_cell = grid.object_cell[i];
+            const uint32_t new_cell = cell_keys[i];
+            if (new_cell == old_cell) {
+                continue;
+            }
+            if (old_cell != CollisionGrid::invalid_cell) {
+                moves[grid.getBucket(old_cell)].removed.push_back(i);
+            }
+            if (new_cell != CollisionGrid::invalid_cell) {
+                moves[grid.getBucket(new_cell)].added.emplace_back(i, new_cell);
+            }
+        }
+    }
+
+    [[nodiscard]]
+    uint32_t getPositionCell(Vec2 position) const
+    {
+        // Safety border to avoid adding object outside the grid
+        if (position.x > 0.0 && position.x < world_size.x &&
+            position.y > 0.0 && position.y < world_size.y) {
+            return grid.getCellId(to<int32_t>(position.x), to<int32_t>(position.y));
+        }
+        return CollisionGrid::invalid_cell;
+    }
+
+    [[nodiscard]]
+    uint32_t getObjectCell(const PhysicObject& obj) const
+    {
+        return getPositionCell(obj.position);
+    }
+
+    void countObjectsSlice(uint32_t slice, uint32_t start, uint32_t end)
+    {
+        ProfileScope scope{ "grid_count_slice", slice };
+        grid.clearSlice(slice);
+        for (uint32_t i{ start }; i < end; ++i) {
+            if (cell_keys[i] != CollisionGrid::invalid_cell) {
+                grid.countAtom(slice, cell_keys[i]);
+            }
+        }
+    }
+
+    void binObjectsSlice(uint32_t slice, uint32_t start, uint32_t end)
+    {
+        ProfileScope scope{ "grid_bin_slice", slice };
+        for (uint32_t i{ start }; i < end; ++i) {
+            const uint32_t cell_id = cell_keys[i];
+            if (cell_id != CollisionGrid::invalid_cell) {
+                grid.binAtom(slice, cell_id, i);
+            }
+            else {
+                grid.insertStray(i);
+            }
+        }
+    }
+
+
+    // Moves objects in grid order, objects outside the grid go last. Object IDs stay valid
+    // and the grid is rewritten to list the objects in index order.
+    void reorderObjects()
+    {
+        ProfileScope scope{ "reorder" };
+        const uint32_t object_count = to<uint32_t>(objects.size());
+        reorder_map.clear();
+        for (int32_t x{ 0 }; x < grid.width; ++x) {
+            for (int32_t y{ 0 }; y < grid.height; ++y) {
+                const uint32_t cell_id = grid.getCellIndex(x, y);
+                const uint32_t start   = grid.cell_start[cell_id];
+                for (uint32_t slot{ start }; slot < start + grid.cell_count[cell_id]; ++slot) {
+                    // The object moves to the index of its position in the map
+                    const uint32_t index = to<uint32_t>(reorder_map.size());
+                    reorder_map.push_back(grid.objects[slot]);
+                    grid.objects[slot]      = index;
+                    grid.object_slot[index] = slot;
                 }
             }
+        }
+        for (uint32_t i{ 0 }; i < object_count; ++i) {
+            if (grid.object_cell[i] == CollisionGrid::invalid_cell) {
+                reorder_map.push_back(i);
+            }
+        }
+        objects.reorder(reorder_map);
+
+        thread_pool.dispatch(object_count, [&](uint32_t start, uint32_t end) {
+            for (uint32_t i{ start }; i < end; ++i) {
+                agents.store(i, objects.data[i]);
+                grid.object_cell[i] = cell_keys[i] = objects.data[i].actual_grid_id;
+            }
         });
     }
+
+    void updateObjects_multi(float dt)
+    {
+        ProfileScope scope{ "integration" };
+        const uint32_t object_count = to<uint32_t>(objects.size());
+        resizeObjectArrays(object_count);
+        thread_pool.dispatch(object_count, [&](uint32_t start, uint32_t end) {
+            ProfileScope batch_scope{ "integration_batch", start };
+            for (uint32_t i{ start }; i < end; ++i) {
+                integrateObject(i, dt);
+            }
+        });
+        endStep();
+    }
+
+    void integrateObject(uint32_t i, float dt)
+    {
+        PhysicObject& obj = objects.data[i];
+        if (symmetric_contacts) {
+            obj.nextVelocity += west_velocity[i];
+            west_velocity[i] = { 0.0, 0.0 };
+        }
+
+        Environment::getInstance().reachingTheBaseDetection(obj);
+        obj.update(dt, CounterRNG(seed, objects.getID(i), step_count * random_per_step));
+
+        //periodic ownership of the border
+        if (obj.position.x > world_size.x) {
+            obj.position.x = obj.position.x - (world_size.x);
+        }
+        else if (obj.position.x < 0.0) {
+            obj.position.x = (obj.position.x) + (world_size.x);
+        }
+        if (obj.position.y > world_size.y) {
+            obj.position.y = obj.position.y - (world_size.y);
+        }
+        else if (obj.position.y < 0.0) {
+            obj.position.y = (obj.position.y) + (world_size.y);
+        }
+
+        // Binning for the next grid update while the object is in cache
+        agents.store(i, obj);
+        obj.actual_grid_id = cell_keys[i] = getObjectCell(obj);
+    }
+
+    void endStep()
+    {
+        cell_keys_valid    = true;
+        cell_keys_op_count = objects.op_count;
+        ++step_count;
+    }
+
+    // Slab of every object slice as in dispatchSlices, the objects outside the grid go to the
+    // extra list slab_count. Called with `fill` false it counts the objects per list, with `fill`
+    // true it writes them at the cursors left by computeSlabListStarts.
+    void binSlabSlice(uint32_t slice, bool fill)
+    {
+        const uint32_t object_count = to<uint32_t>(objects.size());
+        const uint32_t list_count   = to<uint32_t>(slab_object_start.size()) - 1;
+        const uint32_t column_cells = to<uint32_t>(grid.height) + 2;
+        uint32_t* counts = &slab_slice_counts[static_cast<size_t>(slice) * list_count];
+        const uint32_t start = getSliceBound(slice, object_count, grid.slice_count);
+        const uint32_t end   = getSliceBound(slice + 1, object_count, grid.slice_count);
+        for (uint32_t i{ start }; i < end; ++i) {
+            const uint32_t cell_id = grid.object_cell[i];
+            const uint32_t list = cell_id == CollisionGrid::invalid_cell ? list_count - 1 : column_slab[cell_id / column_cells];
+            if (fill) {
+                slab_objects[counts[list]++] = i;
+            }
+            else {
+                ++counts[list];
+            }
+        }
+    }
+
+    // Turns the counts of binSlabSlice into list starts and per slice write cursors, the
+    // slices of a list are written one after the other so the list is in index order
+    void computeSlabListStarts()
+    {
+        const uint32_t list_count  = to<uint32_t>(slab_object_start.size()) - 1;
+        const uint32_t slice_count = grid.slice_count;
+        uint32_t offset = 0;
+        for (uint32_t list{ 0 }; list < list_count; ++list) {
+            slab_object_start[list] = offset;
+            for (uint32_t slice{ 0 }; slice < slice_count; ++slice) {
+                uint32_t& count = slab_slice_counts[static_cast<size_t>(slice) * list_count + list];
+                const uint32_t slice_objects = count;
+                count   = offset;
+                offset += slice_objects;
+            }
+        }
+        slab_object_start[list_count] = offset;
+    }
+
+    // Integrates the objects of slab i in index order, i equal to the slab count integrates the
+    // objects outside the grid. Walking the slab cells instead would read the objects at random.
+    void integrateSlab(uint32_t i, float dt)
+    {
+        ProfileScope scope{ "integration_slab", i };
+        for (uint32_t k{ slab_object_start[i] }; k < slab_object_start[i + 1]; ++k) {
+            integrateObject(slab_objects[k], dt);
+        }
+    }
+
+    // Graph of solveAndIntegrate, with n slabs and s object slices:
+    //  - [0, n) solve the slabs
+    //  - [n, 2n] integrate the slabs, the last one the objects outside the grid
+    //  - [2n + 1, 2n + 1 + s) count the objects of each slice per slab, 2n + 1 + s computes
+    //    the list starts and the s next nodes fill the lists
+    // The lists are built while the slabs are solved. A slab is integrated once its list is
+    // filled and every slab reading or writing its agents (itself and the two around it, the
+    // grid is periodic) is solved.
+    void buildStepGraph(uint32_t slab_count)
+    {
+        const uint32_t slice_count = grid.slice_count;
+        const uint32_t count_first = 2 * slab_count + 1;
+        const uint32_t starts      = count_first + slice_count;
+        const uint32_t fill_first  = starts + 1;
+        step_graph.clear();
+        for (uint32_t i{ 0 }; i < fill_first + slice_count; ++i) {
+            step_graph.addNode();
+        }
+        for (uint32_t i{ 0 }; i < slice_count; ++i) {
+            step_graph.addDependency(starts, count_first + i);
+            step_graph.addDependency(fill_first + i, starts);
+        }
+        for (uint32_t i{ 0 }; i <= slab_count; ++i) {
+            for (uint32_t k{ 0 }; k < slice_count; ++k) {
+                step_graph.addDependency(slab_count + i, fill_first + k);
+            }
+            if (i < slab_count) {
+                const uint32_t previous = (i + slab_count - 1) % slab_count;
+                const uint32_t next     = (i + 1) % slab_count;
+                step_graph.addDependency(slab_count + i, previous);
+                step_graph.addDependency(slab_count + i, i);
+                step_graph.addDependency(slab_count + i, next);
+            }
+        }
+        step_graph.build();
+        step_graph_slabs = slab_count;
+    }
+
+    // solveNeighborhood and updateObjects_multi without the barrier between them: each slab
+    // is integrated as soon as its neighbourhood allows it. The objects are integrated slab
+    // by slab instead of in a single index order, the result is the same.
+    void solveAndIntegrate(float dt)
+    {
+        ProfileScope scope{ "neighbours_integration" };
+        const uint32_t slab_count = prepareSlabs();
+        const uint32_t object_count = to<uint32_t>(objects.size());
+        resizeObjectArrays(object_count);
+        if (slab_count != step_graph_slabs) {
+            buildStepGraph(slab_count);
+        }
+
+        // Slab of every column, halo included so a cell id divided by the column height indexes it
+        column_slab.resize(grid.width + 2);
+        for (uint32_t i{ 0 }; i < slab_count; ++i) {
+            std::fill(column_slab.begin() + slab_bounds[i] + 1, column_slab.begin() + slab_bounds[i + 1] + 1, i);
+        }
+        slab_object_start.resize(slab_count + 2);
+        slab_slice_counts.assign(static_cast<size_t>(grid.slice_count) * (slab_count + 1), 0);
+        growFirstTouch(slab_objects, object_count);
+
+        const uint32_t count_first = 2 * slab_count + 1;
+        const uint32_t fill_first  = count_first + grid.slice_count + 1;
+        step_graph.run(thread_pool, [this, slab_count, count_first, fill_first, dt](uint32_t node) {
+            if (node < slab_count) {
+                solveCollisionThreaded(node);
+            }
+            else if (node < count_first) {
+                integrateSlab(node - slab_count, dt);
+            }
+            else if (node < fill_first - 1) {
+                binSlabSlice(node - count_first, false);
+            }
+            else if (node == fill_first - 1) {
+                computeSlabListStarts();
+            }
+            else {
+                binSlabSlice(node - fill_first, true);
+            }
+        });
+        endStep();
+
+        TimeAnalyzer::getInstance().collision_time = to<float>(scope.getElapsedMs());
+    }
 };
\ No newline at end of file
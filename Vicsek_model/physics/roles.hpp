@@ -0,0 +1,90 @@
+#pragma once
+#include <cstdint>
+
+
+// Roles of the objects. Adding a role only takes a new value here, its traits and a row
+// and a column in the interaction table, kernels are generated for every pair of roles.
+enum class Role : uint8_t
+{
+    Searching,  // 'S' no base reached yet
+    Red,        // 'C' went through the green base
+    Green,      // 'Z' went through the red base
+    Obstacle,   // 'O' dynamic obstacle, static ones live in the ObstacleGrid
+};
+
+constexpr uint32_t role_count = 4;
+
+// Influence of a neighbour on an object
+enum class Interaction : uint8_t
+{
+    None,
+    Repulsion,   // pushed away, 1000 / squared distance
+    Opposition,  // neighbour velocity weighted by its annealing subtracted
+};
+
+struct RoleTraits
+{
+    char symbol;
+    // Static objects are not integrated and do not react to a role change
+    bool is_static;
+};
+
+constexpr RoleTraits role_traits[role_count] = {
+    { 'S', false },
+    { 'C', false },
+    { 'Z', false },
+    { 'O', true  },
+};
+
+// Rows: the object, columns: its neighbour
+constexpr Interaction role_interactions[role_count][role_count] = {
+    //               Searching          Red                      Green                    Obstacle
+    /* Searching */ { Interaction::None, Interaction::None,       Interaction::None,       Interaction::Repulsion },
+    /* Red       */ { Interaction::None, Interaction::None,       Interaction::Opposition, Interaction::Repulsion },
+    /* Green     */ { Interaction::None, Interaction::Opposition, Interaction::None,       Interaction::Repulsion },
+    /* Obstacle  */ { Interaction::None, Interaction::None,       Interaction::None,       Interaction::None      },
+};
+
+constexpr uint32_t getRoleIndex(Role role)
+{
+    return static_cast<uint32_t>(role);
+}
+
+constexpr Role getRole(uint32_t index)
+{
+    return static_cast<Role>(index);
+}
+
+constexpr const RoleTraits& getTraits(Role role)
+{
+    return role_traits[getRoleIndex(role)];
+}
+
+constexpr Interaction getInteraction(Role role, Role neighbour)
+{
+    return role_interactions[getRoleIndex(role)][getRoleIndex(neighbour)];
+}
+
+// Bit i is set when an object of this role is influenced by neighbours of role i
+constexpr uint32_t getInteractionMask(Role role)
+{
+    uint32_t mask = 0;
+    for (uint32_t i{ 0 }; i < role_count; ++i) {
+        if (getInteraction(role, getRole(i)) != Interaction::None) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+}
+
+// Same as getInteractionMask, counting the neighbours that are influenced by the object as well
+constexpr uint32_t getMutualInteractionMask(Role role)
+{
+    uint32_t mask = 0;
+    for (uint32_t i{ 0 }; i < role_count; ++i) {
+        if (getInteraction(role, getRole(i)) != Interaction::None || getInteraction(getRole(i), role) != Interaction::None) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "physics.hpp"
+
+
+struct Scenario
+{
+    // Agents spread over the whole world and the static obstacle walls around the bases.
+    // Positions and velocities are drawn from the solver seed.
+    static void loadDefault(PhysicSolver& solver, uint32_t agent_count)
+    {
+        CounterRNG rng(solver.seed, PhysicSolver::scenario_stream);
+        for (uint32_t i{ agent_count }; i--;) {
+            double random_x = rng.getUnder(solver.world_size.x);
+            double random_y = rng.getUnder(solver.world_size.y);
+
+            const auto id = solver.createObject({ random_x, random_y}, Role::Searching);
+
+            solver.objects[id].velocity.x = rng.getRange(-5.0, 5.0);
+            solver.objects[id].velocity.y = rng.getRange(-5.0, 5.0);
+        }
+
+        for (uint32_t i{ 130 }; i--;) {
+            for (uint32_t j{ 2 }; j--;) {
+                solver.createObstacle({ 20.0 + i*2, 100.0 + j*2 });
+            }
+        }
+
+        for (uint32_t i{ 2 }; i--;) {
+            for (uint32_t j{ 100 }; j--;) {
+                solver.createObstacle({ 20.0 + i * 2, 100.0 + j * 2 });
+            }
+        }
+
+        for (uint32_t i{ 2 }; i--;) {
+            for (uint32_t j{ 110 }; j--;) {
+                solver.createObstacle({ 260.0 + i * 2, 30.0 + j * 2 });
+            }
+        }
+
+        for (uint32_t i{ 100 }; i--;) {
+            for (uint32_t j{ 2 }; j--;) {
+                solver.createObstacle({ 20.0 + i * 2, 200.0 + j * 2 });
+            }
+        }
+
+        for (uint32_t i{ 60 }; i--;) {
+            for (uint32_t j{ 2 }; j--;) {
+                solver.createObstacle({ 140.0 + i * 2, 240.0 + j * 2 });
+            }
+        }
+        /*
+        for (uint32_t i{ 100 }; i--;) {
+            for (uint32_t j{ 2 }; j--;) {
+                solver.createObstacle({ 20.0 + i * 2, 280.0 + j * 2 });
+            }
+        }
+        */
+    }
+};
@@ -7,6 +7,7 @@ Renderer::Renderer(PhysicSolver& solver_, tp::ThreadPool& tp)
     : solver{ solver_ }
     , world_va{ sf::Quads, 4 }
     , objects_va{ sf::Triangles }
+    , obstacles_va{ sf::Triangles }
     , thread_pool{ tp }
 {
     initializeWorldVA();
@@ -18,6 +19,9 @@ void Renderer::render(RenderContext& context)
 
     sf::RenderStates states;
     context.draw(world_va, states);
+    // Obstacles
+    updateObstaclesVA();
+    context.draw(obstacles_va, states);
     // Boids
     updateParticlesVA();
     context.draw(objects_va, states);
@@ -79,7 +83,7 @@ void Renderer::updateParticlesVA()
             objects_va[idx + 1].texCoords = { texture_size, 0.0f };
             objects_va[idx + 2].texCoords = { texture_size/2, texture_size };
 
-            const sf::Color color = object.getColor();
+            const sf::Color color = getRoleColor(object.role);
             objects_va[idx + 0].color = color;
             objects_va[idx + 1].color = color;
             objects_va[idx + 2].color = color;
@@ -87,6 +91,51 @@ void Renderer::updateParticlesVA()
     });
 }
 
+// Obstacles are static, the vertices are only rebuilt when obstacles were added
+void Renderer::updateObstaclesVA()
+{
+    if (obstacles_va.getVertexCount() == solver.obstacles.size() * 3) {
+        return;
+    }
+    obstacles_va.resize(solver.obstacles.size() * 3);
+
+    const float texture_size = 1024.0f;
+    const sf::Color color = getRoleColor(Role::Obstacle);
+    for (uint32_t i{ 0 }; i < solver.obstacles.size(); ++i) {
+        const Vec2& position = solver.obstacles.positions[i];
+        const uint32_t idx = i * 3;
+
+        // Same triangle as an object heading along x
+        obstacles_va[idx + 0].position = FVec2{ 1.0f, 0.0f };
+        obstacles_va[idx + 1].position = FVec2{ 0.0f, 0.5f };
+        obstacles_va[idx + 2].position = FVec2{ 0.0f, -0.5f };
+
+        for (uint32_t j{ idx }; j < idx + 3; ++j) {
+            obstacles_va[j].position.x += (float)position.x;
+            obstacles_va[j].position.y += (float)position.y;
+            obstacles_va[j].color = color;
+        }
+
+        obstacles_va[idx + 0].texCoords = { 0.0f        , 0.0f };
+        obstacles_va[idx + 1].texCoords = { texture_size, 0.0f };
+        obstacles_va[idx + 2].texCoords = { texture_size/2, texture_size };
+    }
+}
+
+sf::Color Renderer::getRoleColor(Role role)
+{
+    if (role == Role::Red) {
+        return sf::Color(255, 0, 0, 255);
+    }
+    if (role == Role::Green) {
+        return sf::Color(0, 255, 0, 255);
+    }
+    if (role == Role::Obstacle) {
+        return sf::Color(255, 255, 255, 255);
+    }
+    return sf::Color(0, 0, 0, 255);
+}
+
 void Renderer::renderHUD(RenderContext& context)
 {
     sf::Font font;
@@ -112,6 +161,11 @@ void Renderer::renderHUD(RenderContext& context)
     current_y += shift;
     context.renderToHUD(text);
 
+    text.setString("Obstacles: " + toString(solver.obstacles.size()));
+    text.setPosition({ margin, current_y });
+    current_y += shift;
+    context.renderToHUD(text);
+
     text.setString("Noise level: " + toString(solver.objects.data[0].noise_module));
     text.setPosition({ margin, current_y });
     current_y += shift;
@@ -148,6 +202,12 @@ void Renderer::renderHUD(RenderContext& context)
     current_y += shift;
     context.renderToHUD(text);
 
+    const tp::IdleStats idle = thread_pool.getIdleStats();
+    text.setString("Workers idle: " + toString(to<int>(idle.spin_ms / 1000.0)) + " s spinning, " + toString(to<int>(idle.park_ms / 1000.0)) + " s parked");
+    text.setPosition({ margin, current_y });
+    current_y += shift;
+    context.renderToHUD(text);
+
     text.setString("Zoom: " + toString(context.getZoom()));
     text.setPosition({ margin, current_y });
     current_y += shift;
@@ -10,6 +10,7 @@ struct Renderer
 
     sf::VertexArray world_va;
     sf::VertexArray objects_va;
+    sf::VertexArray obstacles_va;
     sf::Texture     object_texture;
 
     tp::ThreadPool& thread_pool;
@@ -23,5 +24,9 @@ struct Renderer
 
     void updateParticlesVA();
 
+    void updateObstaclesVA();
+
+    static sf::Color getRoleColor(Role role);
+
     void renderHUD(RenderContext& context);
 };
@@ -0,0 +1,103 @@
+#include <cstring>
+#include <vector>
+#include <random>
+#include <numeric>
+#include <algorithm>
+#include <iostream>
+#include <cstdlib>
+
+#include "../physics/contact_kernel.hpp"
+
+
+// Runs the batched kernels and the scalar Environment::solveContact / solveContactPair / solveObstacleContact on
+// random clustered agents (coincident points and exact view range distances included) and
+// returns false at the first result that is not bit-identical
+static bool checkContactKernel(uint32_t seed, uint32_t agent_count)
+{
+    const double view_range = 5.0;
+
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> position(0.0, 3.0 * view_range);
+    std::uniform_real_distribution<double> velocity(-50.0, 50.0);
+    std::uniform_real_distribution<double> annealing(0.0, 1.0);
+
+    AgentStore agents;
+    agents.resize(agent_count);
+    for (uint32_t i{ 0 }; i < agent_count; ++i) {
+        agents.x[i]         = position(gen);
+        agents.y[i]         = position(gen);
+        agents.vx[i]        = velocity(gen);
+        agents.vy[i]        = velocity(gen);
+        agents.annealing[i] = annealing(gen);
+        agents.role[i]      = getRole(gen() % role_count);
+        if (i && i % 17 == 0) {
+            agents.x[i] = agents.x[i - 1];
+            agents.y[i] = agents.y[i - 1];
+        }
+        else if (i && i % 29 == 0) {
+            agents.x[i] = agents.x[i - 1] + view_range;
+            agents.y[i] = agents.y[i - 1];
+        }
+    }
+
+    std::vector<uint32_t> ids(agent_count);
+    std::iota(ids.begin(), ids.end(), 0u);
+    std::shuffle(ids.begin(), ids.end(), gen);
+
+    // Symmetric accumulators of the neighbours
+    std::vector<Vec2> expected_others(agent_count);
+    std::vector<Vec2> result_others(agent_count);
+    // Spans split by role, as in the neighbour pass
+    std::vector<uint32_t> buckets[role_count];
+
+    const uint32_t max_span = 37;
+    for (uint32_t atom{ 0 }; atom < agent_count; ++atom) {
+        const uint32_t count = 1 + atom % max_span;
+        const uint32_t first = (atom * 7) % (agent_count - max_span);
+        const Vec2 start = { velocity(gen), velocity(gen) };
+
+        for (auto& bucket : buckets) {
+            bucket.clear();
+        }
+        for (uint32_t k{ first }; k < first + count; ++k) {
+            buckets[getRoleIndex(agents.role[ids[k]])].push_back(ids[k]);
+        }
+
+        Vec2 expected = start;
+        Vec2 result   = start;
+        for (uint32_t i{ 0 }; i < role_count; ++i) {
+            ContactKernel::solveScalar(agents, atom, buckets[i].data(), to<uint32_t>(buckets[i].size()), expected, view_range);
+            ContactKernel::solve(agents.role[atom], getRole(i), agents, atom, buckets[i].data(), to<uint32_t>(buckets[i].size()), result, view_range);
+        }
+        if (std::memcmp(&expected, &result, sizeof(Vec2)) != 0) {
+            return false;
+        }
+
+        ContactKernel::solveObstaclesScalar(agents, atom, agents.x.data() + first, agents.y.data() + first, count, expected, view_range);
+        ContactKernel::solveObstacles(agents, atom, agents.x.data() + first, agents.y.data() + first, count, result, view_range);
+        if (std::memcmp(&expected, &result, sizeof(Vec2)) != 0) {
+            return false;
+        }
+
+        const auto expected_of = [&](uint32_t id) -> Vec2& { return expected_others[id]; };
+        const auto result_of   = [&](uint32_t id) -> Vec2& { return result_others[id]; };
+        for (uint32_t i{ 0 }; i < role_count; ++i) {
+            ContactKernel::solveSymmetricScalar(agents, atom, buckets[i].data(), to<uint32_t>(buckets[i].size()), expected, view_range, expected_of);
+            ContactKernel::solveSymmetric(agents.role[atom], getRole(i), agents, atom, buckets[i].data(), to<uint32_t>(buckets[i].size()), result, view_range, result_of);
+        }
+        if (std::memcmp(&expected, &result, sizeof(Vec2)) != 0) {
+            return false;
+        }
+    }
+    return std::memcmp(expected_others.data(), result_others.data(), agent_count * sizeof(Vec2)) == 0;
+}
+
+// Built twice by CMake, with the batched kernel of the target and with VICSEK_SCALAR_CONTACT.
+// Usage: contact_kernel_check [seed]
+int main(int argc, char** argv)
+{
+    const uint32_t seed = argc > 1 ? static_cast<uint32_t>(std::strtoul(argv[1], nullptr, 10)) : 1;
+    const bool compatible = checkContactKernel(seed, 4096);
+    std::cout << "Contact kernel " << (compatible ? "matches" : "differs from") << " the scalar reference" << std::endl;
+    return compatible ? 0 : 1;
+}
@@ -0,0 +1,221 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <thread>
+#include <memory>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <cstdint>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace tp
+{
+
+// Allocator leaving the elements default-initialised on resize, trivial ones are not written.
+// Elements of trivially copyable types are not written either (their default member
+// initialisers do not run), whoever grows the storage has to fill them. Freshly mapped pages
+// are then first touched (and placed on a NUMA node) by whoever fills them.
+// Only meant for the solver arrays filled right after they grow (see growFirstTouch).
+template<typename T>
+struct FirstTouchAllocator : std::allocator<T>
+{
+    template<typename U>
+    struct rebind
+    {
+        using other = FirstTouchAllocator<U>;
+    };
+
+    FirstTouchAllocator() = default;
+
+    template<typename U>
+    FirstTouchAllocator(const FirstTouchAllocator<U>&) noexcept
+    {}
+
+    template<typename U>
+    void construct(U* pointer) noexcept(std::is_nothrow_default_constructible_v<U>)
+    {
+        if constexpr (!std::is_trivially_copyable_v<U> || !std::is_trivially_destructible_v<U>) {
+            ::new (static_cast<void*>(pointer)) U;
+        }
+    }
+
+    template<typename U, typename... TArgs>
+    void construct(U* pointer, TArgs&&... args)
+    {
+        ::new (static_cast<void*>(pointer)) U(std::forward<TArgs>(args)...);
+    }
+};
+
+template<typename T>
+using FirstTouchVector = std::vector<T, FirstTouchAllocator<T>>;
+
+// Logical CPUs of the machine as reported by sysfs. Without sysfs (or on other systems)
+// every hardware thread is its own core on node 0.
+struct CpuTopology
+{
+    struct Cpu
+    {
+        uint32_t id      = 0;
+        uint32_t core    = 0;
+        uint32_t package = 0;
+        uint32_t node    = 0;
+    };
+
+    std::vector<Cpu> cpus;
+
+    static CpuTopology discover()
+    {
+        CpuTopology topology;
+        const std::string cpu_root = "/sys/devices/system/cpu/";
+        std::string online;
+        if (readLine(cpu_root + "online", online)) {
+            for (const uint32_t id : parseList(online)) {
+                const std::string cpu_path = cpu_root + "cpu" + std::to_string(id) + "/topology/";
+                Cpu cpu;
+                cpu.id      = id;
+                cpu.core    = readValue(cpu_path + "core_id", id);
+                cpu.package = readValue(cpu_path + "physical_package_id", 0);
+                topology.cpus.push_back(cpu);
+            }
+            std::string nodes;
+            if (readLine("/sys/devices/system/node/online", nodes)) {
+                for (const uint32_t node : parseList(nodes)) {
+                    std::string node_cpus;
+                    if (!readLine("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist", node_cpus)) {
+                        continue;
+                    }
+                    for (const uint32_t id : parseList(node_cpus)) {
+                        for (Cpu& cpu : topology.cpus) {
+                            if (cpu.id == id) {
+                                cpu.node = node;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        if (topology.cpus.empty()) {
+            const uint32_t count = std::max(1u, std::thread::hardware_concurrency());
+            for (uint32_t i{0}; i < count; ++i) {
+                topology.cpus.push_back({i, i, 0, 0});
+            }
+        }
+        return topology;
+    }
+
+    [[nodiscard]]
+    uint32_t getCoreCount() const
+    {
+        std::vector<std::pair<uint32_t, uint32_t>> cores;
+        for (const Cpu& cpu : cpus) {
+            cores.emplace_back(cpu.package, cpu.core);
+        }
+        std::sort(cores.begin(), cores.end());
+        return static_cast<uint32_t>(std::unique(cores.begin(), cores.end()) - cores.begin());
+    }
+
+    [[nodiscard]]
+    std::vector<uint32_t> getNodes() const
+    {
+        std::vector<uint32_t> nodes;
+        for (const Cpu& cpu : cpus) {
+            nodes.push_back(cpu.node);
+        }
+        std::sort(nodes.begin(), nodes.end());
+        nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+        return nodes;
+    }
+
+    // CPU for each of thread_count workers. Workers are spread over the nodes in proportion
+    // of their CPUs, consecutive workers sharing a node. Within a node every physical core
+    // gets a worker before any SMT sibling does.
+    [[nodiscard]]
+    std::vector<Cpu> getPlacement(uint32_t thread_count) const
+    {
+        std::vector<Cpu> placement;
+        const std::vector<uint32_t> nodes = getNodes();
+        const uint32_t total = static_cast<uint32_t>(cpus.size());
+        uint32_t before = 0;
+        for (const uint32_t node : nodes) {
+            std::vector<Cpu> node_cpus;
+            for (const Cpu& cpu : cpus) {
+                if (cpu.node == node) {
+                    node_cpus.push_back(cpu);
+                }
+            }
+            // Rank of each CPU among the hardware threads of its core
+            std::vector<std::pair<uint32_t, Cpu>> ranked;
+            for (const Cpu& cpu : node_cpus) {
+                uint32_t rank = 0;
+                for (const Cpu& other : node_cpus) {
+                    rank += other.package == cpu.package && other.core == cpu.core && other.id < cpu.id;
+                }
+                ranked.emplace_back(rank, cpu);
+            }
+            std::stable_sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+            const uint32_t first = static_cast<uint32_t>(static_cast<uint64_t>(thread_count) * before / total);
+            before += static_cast<uint32_t>(node_cpus.size());
+            const uint32_t last  = static_cast<uint32_t>(static_cast<uint64_t>(thread_count) * before / total);
+            for (uint32_t i{first}; i < last; ++i) {
+                placement.push_back(ranked[(i - first) % ranked.size()].second);
+            }
+        }
+        return placement;
+    }
+
+    // Restricts a thread to one CPU, returns false where it is not supported
+    static bool pin(std::thread& thread, uint32_t cpu_id)
+    {
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu_id, &set);
+        return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+        (void)thread;
+        (void)cpu_id;
+        return false;
+#endif
+    }
+
+private:
+    static bool readLine(const std::string& path, std::string& line)
+    {
+        std::ifstream file(path);
+        return file && std::getline(file, line) && !line.empty();
+    }
+
+    static uint32_t readValue(const std::string& path, uint32_t fallback)
+    {
+        std::string line;
+        return readLine(path, line) ? static_cast<uint32_t>(std::stoul(line)) : fallback;
+    }
+
+    // sysfs CPU lists, such as "0-3,8-11"
+    static std::vector<uint32_t> parseList(const std::string& list)
+    {
+        std::vector<uint32_t> values;
+        std::stringstream stream(list);
+        std::string item;
+        while (std::getline(stream, item, ',')) {
+            const size_t dash = item.find('-');
+            const uint32_t first = static_cast<uint32_t>(std::stoul(item.substr(0, dash)));
+            const uint32_t last  = dash == std::string::npos ? first : static_cast<uint32_t>(std::stoul(item.substr(dash + 1)));
+            for (uint32_t i{first}; i <= last; ++i) {
+                values.push_back(i);
+            }
+        }
+        return values;
+    }
+};
+
+}
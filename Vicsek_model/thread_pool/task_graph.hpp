@@ -0,0 +1,125 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <utility>
+#include <cstdint>
+
+#include "thread_pool.hpp"
+
+namespace tp
+{
+
+// Dependency graph of nodes run on a ThreadPool. A node is pushed as a task once all its
+// dependencies ran, from the worker that completed the last one, so there is no barrier
+// between the nodes that do not depend on each other.
+// The graph is built once and can be run any number of times without allocating, every
+// node calls the same callback with its index.
+struct TaskGraph
+{
+    using Invoke = void(*)(void*, uint32_t);
+
+    // Successors of node i are m_successors[m_successor_start[i], m_successor_start[i + 1])
+    std::vector<uint32_t>                      m_successor_start;
+    std::vector<uint32_t>                      m_successors;
+    std::vector<uint32_t>                      m_dependency_count;
+    std::unique_ptr<std::atomic<uint32_t>[]>   m_pending;
+    // Edges added since the last build, as (dependency, node)
+    std::vector<std::pair<uint32_t, uint32_t>> m_edges;
+    uint32_t                                   m_node_count = 0;
+
+    ThreadPool*                                m_pool     = nullptr;
+    void*                                      m_callable = nullptr;
+    Invoke                                     m_invoke   = nullptr;
+
+    void clear()
+    {
+        m_edges.clear();
+        m_node_count = 0;
+    }
+
+    uint32_t addNode()
+    {
+        return m_node_count++;
+    }
+
+    // `node` runs after `dependency`, duplicated edges are ignored
+    void addDependency(uint32_t node, uint32_t dependency)
+    {
+        m_edges.emplace_back(dependency, node);
+    }
+
+    // Turns the edges into the successors lists, has to be called before running the graph
+    void build()
+    {
+        std::sort(m_edges.begin(), m_edges.end());
+        m_edges.erase(std::unique(m_edges.begin(), m_edges.end()), m_edges.end());
+
+        m_successor_start.assign(m_node_count + 1, 0);
+        m_dependency_count.assign(m_node_count, 0);
+        m_successors.resize(m_edges.size());
+        for (uint32_t i{0}; i < m_edges.size(); ++i) {
+            ++m_successor_start[m_edges[i].first + 1];
+            ++m_dependency_count[m_edges[i].second];
+            m_successors[i] = m_edges[i].second;
+        }
+        for (uint32_t i{0}; i < m_node_count; ++i) {
+            m_successor_start[i + 1] += m_successor_start[i];
+        }
+        m_pending = std::make_unique<std::atomic<uint32_t>[]>(m_node_count);
+    }
+
+    [[nodiscard]]
+    uint32_t size() const
+    {
+        return m_node_count;
+    }
+
+    // Calls callback(node) for every node in dependency order and returns once all ran.
+    // Has to be called from outside the pool.
+    template<typename TCallback>
+    void run(ThreadPool& pool, TCallback&& callback)
+    {
+        m_pool     = &pool;
+        m_callable = const_cast<void*>(static_cast<const void*>(std::addressof(callback)));
+        m_invoke   = &TaskGraph::call<std::remove_reference_t<TCallback>>;
+        for (uint32_t i{0}; i < m_node_count; ++i) {
+            m_pending[i].store(m_dependency_count[i], std::memory_order_relaxed);
+        }
+        for (uint32_t i{0}; i < m_node_count; ++i) {
+            if (!m_dependency_count[i]) {
+                push(i);
+            }
+        }
+        // Successors are pushed before their last dependency completes, so the pool is
+        // only empty once every node ran
+        pool.waitForCompletion();
+    }
+
+    template<typename TCallback>
+    static void call(void* callable, uint32_t node)
+    {
+        (*static_cast<TCallback*>(callable))(node);
+    }
+
+    void push(uint32_t node)
+    {
+        m_pool->addTask([this, node] {
+            execute(node);
+        });
+    }
+
+    void execute(uint32_t node)
+    {
+        m_invoke(m_callable, node);
+        for (uint32_t i{m_successor_start[node]}; i < m_successor_start[node + 1]; ++i) {
+            const uint32_t successor = m_successors[i];
+            if (m_pending[successor].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                push(successor);
+            }
+        }
+    }
+};
+
+}
@@ -1,152 +1,594 @@
 #pragma once
-#include <functional>
-#include <queue>
 #include <vector>
+#include <algorithm>
 #include <thread>
+#include <chrono>
 #include <mutex>
+#include <condition_variable>
 #include <atomic>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+#include <new>
 #include <iostream>
 
+#include "numa.hpp"
+
 namespace tp
 {
 
-struct TaskQueue
+struct ThreadPool;
+
+// Type-erased callable stored inline: an invoke pointer followed by the callable bytes.
+// Callables must be trivially copyable and fit in the storage, so tasks never allocate.
+struct Task
 {
-    std::queue<std::function<void()>> m_tasks;
-    std::mutex                        m_mutex;
-    std::atomic<uint32_t>             m_remaining_tasks = 0;
+    static constexpr uint32_t word_count    = 8;
+    static constexpr size_t   storage_size  = (word_count - 1) * sizeof(uint64_t);
+
+    using Invoke = void(*)(const void*);
+
+    uint64_t m_words[word_count] = {};
+
+    Task() = default;
 
     template<typename TCallback>
-    void addTask(TCallback&& callback)
+    static Task create(const TCallback& callback)
     {
-        std::lock_guard<std::mutex> lock_guard{m_mutex};
-        m_tasks.push(std::forward<TCallback>(callback));
-        m_remaining_tasks++;
+        static_assert(std::is_trivially_copyable_v<TCallback>, "Task callables must be trivially copyable");
+        static_assert(sizeof(TCallback) <= storage_size, "Task callable too big for the inline storage");
+        static_assert(alignof(TCallback) <= alignof(uint64_t), "Task callable over-aligned");
+
+        Task task;
+        const Invoke invoke = &Task::invoke<TCallback>;
+        std::memcpy(&task.m_words[0], &invoke, sizeof(Invoke));
+        std::memcpy(&task.m_words[1], &callback, sizeof(TCallback));
+        return task;
     }
 
-    void getTask(std::function<void()>& target_callback)
+    void operator()() const
     {
-        {
-            std::lock_guard<std::mutex> lock_guard{m_mutex};
-            if (m_tasks.empty()) {
-                return;
-            }
-            target_callback = std::move(m_tasks.front());
-            m_tasks.pop();
+        Invoke invoke;
+        std::memcpy(&invoke, &m_words[0], sizeof(Invoke));
+        invoke(&m_words[1]);
+    }
+
+    template<typename TCallback>
+    static void invoke(const void* data)
+    {
+        (*std::launder(reinterpret_cast<const TCallback*>(data)))();
+    }
+};
+
+// Fixed capacity Chase-Lev deque: the owner pushes and takes at the bottom, other threads
+// steal at the top. Slots are atomic words so a racing steal only reads a stale copy,
+// which is then discarded by the failed CAS on top.
+struct TaskDeque
+{
+    struct Slot
+    {
+        std::atomic<uint64_t> words[Task::word_count];
+    };
+
+    static constexpr int64_t capacity = 1024;
+
+    std::atomic<int64_t> m_top    = 0;
+    std::atomic<int64_t> m_bottom = 0;
+    std::unique_ptr<Slot[]> m_slots;
+
+    TaskDeque()
+        : m_slots{std::make_unique<Slot[]>(capacity)}
+    {}
+
+    // Returns false when full, the caller then has to run the task itself
+    bool push(const Task& task)
+    {
+        const int64_t b = m_bottom.load(std::memory_order_relaxed);
+        const int64_t t = m_top.load(std::memory_order_acquire);
+        if (b - t >= capacity) {
+            return false;
+        }
+        write(b, task);
+        m_bottom.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Owner only
+    bool take(Task& task)
+    {
+        const int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        if (t > b) {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        read(b, task);
+        if (t == b) {
+            // Last element, race against thieves
+            const bool won = m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    bool steal(Task& task)
+    {
+        int64_t t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t b = m_bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return false;
+        }
+        read(t, task);
+        return m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+private:
+    void write(int64_t i, const Task& task)
+    {
+        Slot& slot = m_slots[i & (capacity - 1)];
+        for (uint32_t k{0}; k < Task::word_count; ++k) {
+            slot.words[k].store(task.m_words[k], std::memory_order_relaxed);
+        }
+    }
+
+    void read(int64_t i, Task& task) const
+    {
+        const Slot& slot = m_slots[i & (capacity - 1)];
+        for (uint32_t k{0}; k < Task::word_count; ++k) {
+            task.m_words[k] = slot.words[k].load(std::memory_order_relaxed);
         }
     }
+};
+
+// Parallel-for shared with the workers: a reference to the callable and chunk counters.
+// The fields are written before `epoch` turns odd and stay valid until it is even again
+// and no worker is registered in `users`, so publishing a loop needs no allocation.
+// The chunks are split in one contiguous range per NUMA node, a thread drains the range
+// of its node before helping the others (unless `local_only`).
+struct ParallelFor
+{
+    using Invoke = void(*)(void*, uint32_t, uint32_t);
+
+    static constexpr uint32_t max_nodes = 8;
 
-    static void wait()
+    struct alignas(64) ChunkRange
     {
-        std::this_thread::yield();
+        std::atomic<uint32_t> next = 0;
+        uint32_t              end  = 0;
+    };
+
+    void*                 callable      = nullptr;
+    Invoke                invoke        = nullptr;
+    uint32_t              element_count = 0;
+    uint32_t              chunk_size    = 0;
+    uint32_t              chunk_count   = 0;
+    uint32_t              range_count   = 1;
+    bool                  local_only    = false;
+    ChunkRange            ranges[max_nodes];
+    std::atomic<uint32_t> done_chunks   = 0;
+    // Workers currently reading the fields
+    std::atomic<uint32_t> users         = 0;
+    // Odd while a loop is running
+    std::atomic<uint64_t> epoch         = 0;
+
+    template<typename TCallback>
+    static void call(void* callable, uint32_t start, uint32_t end)
+    {
+        (*static_cast<TCallback*>(callable))(start, end);
     }
 
-    void waitForCompletion() const
+    // First chunk of the range of node i
+    [[nodiscard]]
+    uint32_t getRangeStart(uint32_t i) const
     {
-        //std::cout << "=====================" << std::endl;
-        while (m_remaining_tasks > 0) {
-            //std::cout << "liczba pracujacych watkow: " << m_remaining_tasks << std::endl;
-            wait();
+        return static_cast<uint32_t>(static_cast<uint64_t>(chunk_count) * i / range_count);
+    }
+
+    void setRanges(uint32_t node_count)
+    {
+        range_count = std::max(1u, std::min({node_count, chunk_count, max_nodes}));
+        for (uint32_t i{0}; i < range_count; ++i) {
+            ranges[i].next.store(getRangeStart(i), std::memory_order_relaxed);
+            ranges[i].end = getRangeStart(i + 1);
         }
     }
 
-    void workDone()
+    // Runs chunks until none is left, returns how many were run
+    uint32_t drain(uint32_t node)
     {
-        m_remaining_tasks--;
+        uint32_t count = 0;
+        if (local_only && node >= range_count) {
+            return 0;
+        }
+        const uint32_t visited = local_only ? 1 : range_count;
+        for (uint32_t k{0}; k < visited; ++k) {
+            ChunkRange& range = ranges[(node + k) % range_count];
+            for (uint32_t chunk = range.next.fetch_add(1, std::memory_order_relaxed); chunk < range.end;
+                 chunk = range.next.fetch_add(1, std::memory_order_relaxed)) {
+                const uint32_t start = chunk * chunk_size;
+                invoke(callable, start, std::min(start + chunk_size, element_count));
+                ++count;
+            }
+        }
+        return count;
     }
 };
 
 struct Worker
 {
-    uint32_t              m_id      = 0;
-    std::thread           m_thread;
-    std::function<void()> m_task    = nullptr;
-    bool                  m_running = true;
-    TaskQueue*            m_queue   = nullptr;
+    using Clock = std::chrono::steady_clock;
 
-    Worker() = default;
+    uint32_t          m_id   = 0;
+    ThreadPool*       m_pool = nullptr;
+    TaskDeque         m_deque;
+    std::thread       m_thread;
+    // Index of the NUMA node the worker is pinned on, among the nodes of the pool
+    std::atomic<uint32_t> m_node = 0;
 
-    Worker(TaskQueue& queue, uint32_t id)
+    // Idle time in nanoseconds, only written by the worker
+    std::atomic<uint64_t> m_spin_ns = 0;
+    std::atomic<uint64_t> m_park_ns = 0;
+    std::atomic<uint64_t> m_parks   = 0;
+
+    Worker(ThreadPool& pool, uint32_t id)
         : m_id{id}
-        , m_queue{&queue}
+        , m_pool{&pool}
+    {}
+
+    void start()
     {
         m_thread = std::thread([this](){
             run();
         });
     }
 
-    void run()
+    void run();
+
+    void join()
     {
-        while (m_running) {
-            m_queue->getTask(m_task);
-            if (m_task == nullptr) {
-                TaskQueue::wait();
-            } else {
-                m_task();
-                m_queue->workDone();
-                m_task = nullptr;
-            }
-        }
+        m_thread.join();
     }
 
-    void stop()
+    static void addElapsed(std::atomic<uint64_t>& counter, Clock::time_point start, Clock::time_point end)
     {
-        m_running = false;
-        m_thread.join();
+        counter.fetch_add(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()),
+                          std::memory_order_relaxed);
     }
 };
 
+// Time the workers spent looking for work before parking and parked, summed over the workers
+struct IdleStats
+{
+    double   spin_ms = 0.0;
+    double   park_ms = 0.0;
+    uint64_t parks   = 0;
+};
+
+// Identifies the pool worker running on the current thread, if any
+struct WorkerContext
+{
+    ThreadPool* pool = nullptr;
+    uint32_t    id   = 0;
+};
+
+inline thread_local WorkerContext t_worker_context;
+
 struct ThreadPool
 {
-    uint32_t            m_thread_count = 0;
-    TaskQueue           m_queue;
-    std::vector<Worker> m_workers;
+    // Failed work searches before a worker parks
+    static constexpr uint32_t default_spin_count = 64;
+    // Elements per dispatch chunk when none is given
+    static constexpr uint32_t default_grain_size = 1024;
+
+    uint32_t                             m_thread_count = 0;
+    // Failed work searches (yields) before a worker parks, 0 parks as soon as there is
+    // nothing to do. Also bounds the yields of a thread waiting for completion.
+    // Can be changed while the workers run.
+    std::atomic<uint32_t>                m_spin_count   = default_spin_count;
+    // Elements per dispatch chunk, the chunks only depend on it and on the element count
+    uint32_t                             m_grain_size   = default_grain_size;
+    // NUMA nodes the workers are pinned on, 1 when they are not pinned
+    uint32_t                             m_node_count   = 1;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    // Deque of the tasks submitted from outside the pool. Only its owner may push on a
+    // Chase-Lev deque, so external threads take the mutex to push one at a time.
+    TaskDeque                            m_submission;
+    std::mutex                           m_submission_mutex;
+    std::atomic<uint32_t>                m_remaining_tasks = 0;
+    std::atomic<bool>                    m_running         = true;
+
+    // Idle workers park here, m_epoch changes on every submission
+    std::mutex              m_park_mutex;
+    std::condition_variable m_park_cv;
+    std::atomic<uint64_t>   m_epoch    = 0;
+    std::atomic<uint32_t>   m_sleepers = 0;
+
+    // The thread waiting for completion parks here
+    std::mutex              m_done_mutex;
+    std::condition_variable m_done_cv;
+
+    // Loop run by dispatch, only one at a time
+    ParallelFor             m_for;
 
     explicit
     ThreadPool(uint32_t thread_count)
         : m_thread_count{thread_count}
     {
         m_workers.reserve(thread_count);
-        for (uint32_t i{thread_count}; i--;) {
-            m_workers.emplace_back(m_queue, static_cast<uint32_t>(m_workers.size()));
+        for (uint32_t i{0}; i < thread_count; ++i) {
+            m_workers.push_back(std::make_unique<Worker>(*this, i));
+        }
+        for (auto& worker : m_workers) {
+            worker->start();
         }
     }
 
     virtual ~ThreadPool()
     {
-        for (Worker& worker : m_workers) {
-            worker.stop();
+        m_running = false;
+        wake();
+        for (auto& worker : m_workers) {
+            worker->join();
         }
     }
 
+    // Callable from any thread, workers included. The callable is stored inline in the
+    // task: it has to be trivially copyable and at most Task::storage_size (56) bytes, so
+    // capture references or pointers rather than containers.
     template<typename TCallback>
     void addTask(TCallback&& callback)
     {
-        m_queue.addTask(std::forward<TCallback>(callback));
+        push(Task::create(callback));
+        wake();
     }
 
-    void waitForCompletion() const
+    void waitForCompletion()
     {
-        m_queue.waitForCompletion();
+        for (uint32_t i{m_spin_count.load(std::memory_order_relaxed)}; i--;) {
+            if (m_remaining_tasks.load(std::memory_order_acquire) == 0) {
+                return;
+            }
+            std::this_thread::yield();
+        }
+        std::unique_lock<std::mutex> lock{m_done_mutex};
+        m_done_cv.wait(lock, [this]{ return m_remaining_tasks.load(std::memory_order_acquire) == 0; });
     }
 
-    template<typename TCallback>
-    void dispatch(uint32_t element_count, TCallback&& callback)
+    [[nodiscard]]
+    IdleStats getIdleStats() const
+    {
+        IdleStats stats;
+        for (const auto& worker : m_workers) {
+            stats.spin_ms += worker->m_spin_ns.load(std::memory_order_relaxed) * 1e-6;
+            stats.park_ms += worker->m_park_ns.load(std::memory_order_relaxed) * 1e-6;
+            stats.parks   += worker->m_parks.load(std::memory_order_relaxed);
+        }
+        return stats;
+    }
+
+    // Pins each worker on a CPU, see CpuTopology::getPlacement. Returns false when pinning
+    // is not supported, the workers then stay unpinned.
+    bool pin(const CpuTopology& topology)
     {
-        const uint32_t batch_size = element_count / m_thread_count;
+        const std::vector<CpuTopology::Cpu> placement = topology.getPlacement(m_thread_count);
+        std::vector<uint32_t> nodes;
+        for (const CpuTopology::Cpu& cpu : placement) {
+            if (std::find(nodes.begin(), nodes.end(), cpu.node) == nodes.end()) {
+                nodes.push_back(cpu.node);
+            }
+        }
         for (uint32_t i{0}; i < m_thread_count; ++i) {
-            const uint32_t start = batch_size * i;
-            const uint32_t end   = start + batch_size;
-            addTask([start, end, &callback](){ callback(start, end); });
+            if (!CpuTopology::pin(m_workers[i]->m_thread, placement[i].id)) {
+                return false;
+            }
+            m_workers[i]->m_node.store(static_cast<uint32_t>(std::find(nodes.begin(), nodes.end(), placement[i].node) - nodes.begin()),
+                                       std::memory_order_relaxed);
+        }
+        m_node_count = std::min(static_cast<uint32_t>(nodes.size()), ParallelFor::max_nodes);
+        return true;
+    }
+
+    // Calls callback(start, end) over [0, element_count) in chunks of grain_size elements
+    // (m_grain_size when 0), the last one being shorter. Workers and the calling thread pull
+    // the chunks from m_for, nothing is queued. Chunk bounds do not depend on the threads,
+    // so the calls are the same whichever thread runs them.
+    // Called from a worker (nested loop) everything runs on that worker.
+    template<typename TCallback>
+    void dispatch(uint32_t element_count, TCallback&& callback, uint32_t grain_size = 0)
+    {
+        startParallelFor(element_count, callback, grain_size, false);
+    }
+
+    // Same chunks as dispatch, each one run by a worker of the node whose range holds it,
+    // the calling thread only waits. Used to fill fresh FirstTouchVector storage so its
+    // pages land on the node that processes them in later dispatches.
+    // Without pinning it is a plain call on the calling thread.
+    template<typename TCallback>
+    void firstTouch(uint32_t element_count, TCallback&& callback, uint32_t grain_size = 0)
+    {
+        if (m_node_count < 2) {
+            callback(0u, element_count);
+            return;
+        }
+        startParallelFor(element_count, callback, grain_size, true);
+    }
+
+    template<typename TCallback>
+    void startParallelFor(uint32_t element_count, TCallback& callback, uint32_t grain_size, bool local_only)
+    {
+        const uint32_t chunk_size = std::max(grain_size ? grain_size : m_grain_size, 1u);
+        if (element_count <= chunk_size || t_worker_context.pool == this) {
+            callback(0u, element_count);
+            return;
+        }
+
+        m_for.callable      = const_cast<void*>(static_cast<const void*>(std::addressof(callback)));
+        m_for.invoke        = &ParallelFor::call<std::remove_reference_t<TCallback>>;
+        m_for.element_count = element_count;
+        m_for.chunk_size    = chunk_size;
+        m_for.chunk_count   = (element_count + chunk_size - 1) / chunk_size;
+        m_for.local_only    = local_only;
+        m_for.setRanges(m_node_count);
+        m_for.done_chunks.store(0, std::memory_order_relaxed);
+        const uint64_t epoch = m_for.epoch.load(std::memory_order_relaxed);
+        m_for.epoch.store(epoch + 1, std::memory_order_seq_cst);
+        wake();
+
+        // The caller works too instead of waiting, starting with the first node
+        if (!local_only) {
+            const uint32_t count = m_for.drain(0);
+            if (count) {
+                m_for.done_chunks.fetch_add(count, std::memory_order_acq_rel);
+            }
+        }
+
+        waitForParallelFor();
+        // Retire the loop, then wait for the workers still reading it
+        m_for.epoch.store(epoch + 2, std::memory_order_seq_cst);
+        while (m_for.users.load(std::memory_order_seq_cst)) {
+            std::this_thread::yield();
+        }
+    }
+
+    void waitForParallelFor()
+    {
+        const auto done = [this]{ return m_for.done_chunks.load(std::memory_order_acquire) == m_for.chunk_count; };
+        for (uint32_t i{m_spin_count.load(std::memory_order_relaxed)}; i--;) {
+            if (done()) {
+                return;
+            }
+            std::this_thread::yield();
+        }
+        std::unique_lock<std::mutex> lock{m_done_mutex};
+        m_done_cv.wait(lock, done);
+    }
+
+    // Worker side: pulls chunks of the running loop, if any. Returns true when chunks were run.
+    bool runParallelFor(uint32_t node)
+    {
+        if (!(m_for.epoch.load(std::memory_order_acquire) & 1)) {
+            return false;
+        }
+        m_for.users.fetch_add(1, std::memory_order_seq_cst);
+        uint32_t count = 0;
+        if (m_for.epoch.load(std::memory_order_seq_cst) & 1) {
+            count = m_for.drain(node);
+            if (count && m_for.done_chunks.fetch_add(count, std::memory_order_acq_rel) + count == m_for.chunk_count) {
+                std::lock_guard<std::mutex> lock{m_done_mutex};
+                m_done_cv.notify_all();
+            }
+        }
+        m_for.users.fetch_sub(1, std::memory_order_seq_cst);
+        return count != 0;
+    }
+
+    // Pushes on the current worker deque, or on the submission deque from outside the pool.
+    // When the deque is full the task runs immediately on the calling thread.
+    void push(const Task& task)
+    {
+        m_remaining_tasks.fetch_add(1, std::memory_order_relaxed);
+        bool pushed;
+        if (t_worker_context.pool == this) {
+            pushed = m_workers[t_worker_context.id]->m_deque.push(task);
+        }
+        else {
+            std::lock_guard<std::mutex> lock{m_submission_mutex};
+            pushed = m_submission.push(task);
+        }
+        if (!pushed) {
+            execute(task);
+        }
+    }
+
+    void wake()
+    {
+        m_epoch.fetch_add(1, std::memory_order_seq_cst);
+        if (m_sleepers.load(std::memory_order_seq_cst)) {
+            std::lock_guard<std::mutex> lock{m_park_mutex};
+            m_park_cv.notify_all();
+        }
+    }
+
+    // Own deque first, then the submission deque, then the other workers
+    bool findTask(uint32_t worker_id, Task& task)
+    {
+        if (m_workers[worker_id]->m_deque.take(task)) {
+            return true;
         }
+        if (m_submission.steal(task)) {
+            return true;
+        }
+        for (uint32_t i{1}; i < m_thread_count; ++i) {
+            if (m_workers[(worker_id + i) % m_thread_count]->m_deque.steal(task)) {
+                return true;
+            }
+        }
+        return false;
+    }
 
-        if (batch_size * m_thread_count < element_count) {
-            const uint32_t start = batch_size * m_thread_count;
-            callback(start, element_count);
+    void execute(const Task& task)
+    {
+        task();
+        if (m_remaining_tasks.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock{m_done_mutex};
+            m_done_cv.notify_all();
         }
+    }
 
-        waitForCompletion();
+    void park(uint64_t epoch)
+    {
+        m_sleepers.fetch_add(1, std::memory_order_seq_cst);
+        {
+            std::unique_lock<std::mutex> lock{m_park_mutex};
+            m_park_cv.wait(lock, [this, epoch]{
+                return m_epoch.load(std::memory_order_seq_cst) != epoch || !m_running;
+            });
+        }
+        m_sleepers.fetch_sub(1, std::memory_order_seq_cst);
     }
 };
 
+inline void Worker::run()
+{
+    t_worker_context = {m_pool, m_id};
+    Task task;
+    uint32_t failed = 0;
+    // Start of the current run of failed searches
+    Clock::time_point idle_start;
+    while (m_pool->m_running) {
+        const uint64_t epoch = m_pool->m_epoch.load(std::memory_order_seq_cst);
+        bool worked = m_pool->runParallelFor(m_node.load(std::memory_order_relaxed));
+        if (!worked && m_pool->findTask(m_id, task)) {
+            m_pool->execute(task);
+            worked = true;
+        }
+        if (worked) {
+            if (failed) {
+                addElapsed(m_spin_ns, idle_start, Clock::now());
+                failed = 0;
+            }
+            continue;
+        }
+
+        if (!failed) {
+            idle_start = Clock::now();
+        }
+        if (++failed < m_pool->m_spin_count.load(std::memory_order_relaxed)) {
+            std::this_thread::yield();
+        } else {
+            const Clock::time_point park_start = Clock::now();
+            addElapsed(m_spin_ns, idle_start, park_start);
+            m_pool->park(epoch);
+            addElapsed(m_park_ns, park_start, Clock::now());
+            m_parks.fetch_add(1, std::memory_order_relaxed);
+            failed = 0;
+        }
+    }
+}
+
 }